@@ -0,0 +1,11 @@
+/*
+ * buildinfo.h - When and from which revision mdriver was built, for the
+ *     -o results. The Makefile generates buildinfo.c.
+ */
+#ifndef __BUILDINFO_H_
+#define __BUILDINFO_H_
+
+extern const char build_rev[];  /* git describe --always --dirty, or "" */
+extern const char build_date[]; /* __DATE__ and __TIME__ of the build */
+
+#endif /* __BUILDINFO_H_ */
@@ -0,0 +1,669 @@
+/*
+ * capture.c - LD_PRELOAD shim that records a program's heap requests
+ *     as an mdriver trace
+ *
+ * Build with "make libmmcapture.so" and run a program as
+ *
+ *	MMCAPTURE_FILE=out.%p.rep LD_PRELOAD=./libmmcapture.so <program>
+ *
+ * which writes out.<pid>.rep (mmcapture.<pid>.rep without MMCAPTURE_FILE).
+ * malloc, calloc, realloc, free and the aligned allocators are passed
+ * to the next definitions (normally libc) found with dlsym(RTLD_NEXT).
+ * Every block gets a shim_hdr_t in front of it that holds its trace id,
+ * so free and realloc find the id without any shared table. calloc and
+ * the aligned allocators are recorded as plain allocations, since the
+ * trace format has only a, r and f requests.
+ *
+ * Each thread records into its own single-producer ring without locks.
+ * A global atomic sequence number orders the requests of all threads,
+ * and a writer thread drains the rings, puts the requests back in
+ * sequence order, and writes them out. When the program exits, the
+ * writer finishes and the header (written first as a fixed-width
+ * placeholder) is filled in. The file can then be given to mdriver -f.
+ * A program that dies without running exit handlers leaves a file whose
+ * header is all zeros.
+ *
+ * The ids of freed blocks are reused, so the number of ids in the trace
+ * follows the peak number of live blocks rather than the number of
+ * allocations. Each thread keeps a small stack of free ids and trades
+ * batches of them with a shared pool, so reuse takes a lock only once
+ * per ID_BATCH requests. An id is only released after its free is
+ * recorded, and so its next allocation comes later in the trace. If the
+ * ids still run out at INT_MAX, recording stops with a warning and the
+ * trace so far is kept.
+ *
+ * Requests that the format can't express are not recorded: blocks of 0
+ * or more than INT_MAX bytes, and blocks allocated before the shim
+ * started recording. A later realloc of such a block is recorded as an
+ * allocation of a new id.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_SIZE   4096     /* requests per thread ring */
+#define WINDOW_SIZE (1 << 16) /* requests the writer can hold for reordering */
+#define HDR_WIDTH   11       /* width of each trace header field */
+#define BOOT_SIZE   4096     /* bytes for allocations made by dlsym */
+#define ID_CACHE    256      /* free ids a thread keeps */
+#define ID_BATCH    (ID_CACHE / 2) /* free ids moved to or from the pool */
+#define POOL_MIN    (1 << 20) /* initial size of the shared id pool */
+
+/* Header in front of every block handed out by the shim */
+typedef struct {
+    int64_t id;      /* trace id, or -1 if the block isn't recorded */
+    uint64_t offset; /* bytes from the real block start to the payload */
+} shim_hdr_t;
+
+#define HDR(p) ((shim_hdr_t *)(p) - 1)
+#define BASE(p) ((char *)(p) - HDR(p)->offset)
+
+/* Was p handed out from boot_buf? Such blocks have no header */
+#define IS_BOOT(p) ((char *)(p) >= boot_buf && (char *)(p) < boot_buf + BOOT_SIZE)
+/* Bytes from p to the end of the boot_buf space handed out so far */
+#define BOOT_LEFT(p) ((size_t)(boot_buf + boot_used - (char *)(p)))
+
+/* One recorded request */
+typedef struct {
+    uint64_t seq;  /* position in the trace */
+    int32_t id;
+    uint32_t size; /* 0 for free */
+    char type;     /* 'a', 'r' or 'f' */
+} event_t;
+
+/* Ring of one thread's requests, never freed once mapped */
+typedef struct ring_t {
+    uint64_t head;       /* next event the writer reads */
+    uint64_t tail;       /* next event the owner writes */
+    int state;           /* RING_FREE, RING_OWNED or RING_DEAD */
+    struct ring_t *next; /* list of all rings */
+    event_t ev[RING_SIZE];
+} ring_t;
+
+enum { RING_FREE, RING_OWNED, RING_DEAD };
+
+/* The next allocator, resolved on first use */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+static size_t (*real_usable_size)(void *);
+static int resolving; /* set while dlsym may call back into calloc */
+
+/* Allocations made by dlsym while resolving, never freed */
+static char boot_buf[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+
+/* Capture state */
+static int recording;       /* are requests being recorded? */
+static uint64_t next_seq;   /* sequence number of the next request */
+static uint64_t end_seq = UINT64_MAX; /* requests at or after this are dropped */
+static int64_t next_id;     /* id of the next recorded block */
+static ring_t *rings;       /* all thread rings */
+static FILE *out;           /* trace file */
+static pthread_t writer;
+static pthread_key_t ring_key;
+
+/* Shared pool of free ids, in an mmap'ed array that grows with mremap */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static int32_t *pool;
+static size_t pool_count, pool_size;
+
+/* Set while the shim itself allocates, so that isn't recorded */
+static __thread int in_shim __attribute__((tls_model("initial-exec")));
+static __thread ring_t *my_ring __attribute__((tls_model("initial-exec")));
+static __thread int32_t my_ids[ID_CACHE] __attribute__((tls_model("initial-exec")));
+static __thread int my_id_count __attribute__((tls_model("initial-exec")));
+
+static void resolve(void);
+static void *wrap(char *base, size_t offset, size_t size, int record);
+static void record(char type, int64_t id, size_t size);
+static int64_t new_id(void);
+static void release_id(int64_t id);
+static void pool_move(int to_pool);
+static void stop_recording(void);
+static ring_t *get_ring(void);
+static void release_ring(void *ring);
+static void *write_trace(void *arg);
+static void stop_in_child(void);
+
+/*******************************
+ * The interposed allocator API
+ *******************************/
+
+void *malloc(size_t size)
+{
+    if (real_malloc == NULL)
+	resolve();
+    if (size > SIZE_MAX - sizeof(shim_hdr_t))
+	return NULL;
+    return wrap(real_malloc(size + sizeof(shim_hdr_t)), sizeof(shim_hdr_t),
+		size, 1);
+}
+
+void *calloc(size_t n, size_t size)
+{
+    char *p;
+
+    if (resolving) {
+	/* dlsym needs memory before we know the real calloc */
+	size = (n * size + 15) & ~(size_t)15;
+	if (boot_used + size > BOOT_SIZE)
+	    return NULL;
+	p = boot_buf + boot_used;
+	boot_used += size;
+	return p;
+    }
+    if (real_calloc == NULL)
+	resolve();
+    if (size != 0 && n > (SIZE_MAX - sizeof(shim_hdr_t)) / size) {
+	errno = ENOMEM;
+	return NULL;
+    }
+    return wrap(real_calloc(1, n * size + sizeof(shim_hdr_t)),
+		sizeof(shim_hdr_t), n * size, 1);
+}
+
+void free(void *p)
+{
+    if (p == NULL || IS_BOOT(p))
+	return;
+    if (HDR(p)->id >= 0) {
+	record('f', HDR(p)->id, 0);
+	release_id(HDR(p)->id);
+    }
+    real_free(BASE(p));
+}
+
+void *realloc(void *p, size_t size)
+{
+    char *newp;
+    int64_t id;
+    size_t old_size;
+
+    if (p == NULL)
+	return malloc(size);
+    if (IS_BOOT(p)) {
+	if ((newp = malloc(size)) != NULL)
+	    memcpy(newp, p, size < BOOT_LEFT(p) ? size : BOOT_LEFT(p));
+	return newp;
+    }
+    if (size == 0) {
+	free(p);
+	return NULL;
+    }
+    if (size > SIZE_MAX - sizeof(shim_hdr_t) - HDR(p)->offset)
+	return NULL;
+    id = HDR(p)->id;
+
+    if (HDR(p)->offset == sizeof(shim_hdr_t)) {
+	/* The real realloc moves the header along with the payload */
+	if ((newp = real_realloc(BASE(p), size + sizeof(shim_hdr_t))) == NULL)
+	    return NULL;
+	newp += sizeof(shim_hdr_t);
+    }
+    else {
+	/* Aligned blocks are copied into a plain block, like libc does */
+	if ((newp = wrap(real_malloc(size + sizeof(shim_hdr_t)),
+			 sizeof(shim_hdr_t), size, 0)) == NULL)
+	    return NULL;
+	old_size = real_usable_size(BASE(p)) - HDR(p)->offset;
+	memcpy(newp, p, size < old_size ? size : old_size);
+	real_free(BASE(p));
+    }
+
+    if (id >= 0 && size <= INT_MAX)
+	record('r', id, size);
+    else if (id >= 0) {
+	record('f', id, 0);
+	release_id(id);
+	HDR(newp)->id = -1;
+    }
+    else if (size <= INT_MAX && recording && !in_shim &&
+	     (HDR(newp)->id = new_id()) >= 0)
+	record('a', HDR(newp)->id, size);
+    else
+	HDR(newp)->id = -1;
+    return newp;
+}
+
+int posix_memalign(void **memptr, size_t align, size_t size)
+{
+    char *base;
+    size_t offset;
+
+    if (align < sizeof(void *) || (align & (align - 1)) != 0)
+	return EINVAL;
+    if (align <= sizeof(shim_hdr_t)) {
+	*memptr = malloc(size);
+	return *memptr == NULL ? ENOMEM : 0;
+    }
+    if (real_malloc == NULL)
+	resolve();
+    if (size > SIZE_MAX - align - sizeof(shim_hdr_t) ||
+	(base = real_malloc(size + align + sizeof(shim_hdr_t))) == NULL)
+	return ENOMEM;
+    offset = align - ((uintptr_t)(base + sizeof(shim_hdr_t)) & (align - 1));
+    if (offset == align)
+	offset = 0;
+    *memptr = wrap(base, offset + sizeof(shim_hdr_t), size, 1);
+    return 0;
+}
+
+void *aligned_alloc(size_t align, size_t size)
+{
+    void *p;
+    int err;
+
+    if (align < sizeof(void *))
+	align = sizeof(void *);
+    if ((err = posix_memalign(&p, align, size)) != 0) {
+	errno = err;
+	return NULL;
+    }
+    return p;
+}
+
+void *memalign(size_t align, size_t size)
+{
+    return aligned_alloc(align, size);
+}
+
+void *valloc(size_t size)
+{
+    return aligned_alloc(sysconf(_SC_PAGESIZE), size);
+}
+
+void *pvalloc(size_t size)
+{
+    size_t page = sysconf(_SC_PAGESIZE);
+
+    return aligned_alloc(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *p)
+{
+    if (p == NULL)
+	return 0;
+    if (IS_BOOT(p))
+	return BOOT_LEFT(p);
+    return real_usable_size(BASE(p)) - HDR(p)->offset;
+}
+
+/**********************
+ * Capture start and end
+ **********************/
+
+/*
+ * start_capture - open the trace file, write a placeholder header and
+ *     start the writer thread. A "%p" in MMCAPTURE_FILE is replaced by
+ *     the process id, so that programs that start other programs (which
+ *     inherit LD_PRELOAD) get one trace per process.
+ */
+__attribute__((constructor))
+static void start_capture(void)
+{
+    char path[PATH_MAX];
+    char *env = getenv("MMCAPTURE_FILE");
+    char *pid;
+    int i;
+
+    in_shim = 1;
+    if (real_malloc == NULL)
+	resolve();
+    if (env == NULL)
+	snprintf(path, sizeof(path), "mmcapture.%d.rep", (int)getpid());
+    else if ((pid = strstr(env, "%p")) != NULL)
+	snprintf(path, sizeof(path), "%.*s%d%s", (int)(pid - env), env,
+		 (int)getpid(), pid + 2);
+    else
+	snprintf(path, sizeof(path), "%s", env);
+    if ((out = fopen(path, "w")) == NULL) {
+	fprintf(stderr, "mmcapture: can't open %s: %s\n", path, strerror(errno));
+	in_shim = 0;
+	return;
+    }
+    for (i = 0; i < 4; i++)
+	fprintf(out, "%*d\n", HDR_WIDTH, 0);
+
+    pthread_key_create(&ring_key, release_ring);
+    pthread_atfork(NULL, NULL, stop_in_child);
+    __atomic_store_n(&recording, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&writer, NULL, write_trace, NULL) != 0) {
+	recording = 0;
+	fclose(out);
+	out = NULL;
+    }
+    in_shim = 0;
+}
+
+/*
+ * stop_capture - stop recording, let the writer finish every request
+ *     taken so far, then fill in the header
+ */
+__attribute__((destructor))
+static void stop_capture(void)
+{
+    if (out == NULL)
+	return;
+    in_shim = 1;
+    stop_recording();
+    pthread_join(writer, NULL);
+    fclose(out);
+    out = NULL;
+}
+
+/*
+ * stop_recording - drop all requests from now on. The writer finishes
+ *     the ones already numbered and exits.
+ */
+static void stop_recording(void)
+{
+    __atomic_store_n(&recording, 0, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&end_seq, __atomic_load_n(&next_seq, __ATOMIC_SEQ_CST),
+		     __ATOMIC_SEQ_CST);
+}
+
+/*
+ * stop_in_child - a forked child has no writer thread, so it must not
+ *     fill its rings. Its copy of out still holds the parent's buffered
+ *     requests, which exit would flush into the shared file, so the
+ *     stream's descriptor is pointed at /dev/null first.
+ */
+static void stop_in_child(void)
+{
+    int fd;
+
+    recording = 0;
+    if (out == NULL)
+	return;
+    if ((fd = open("/dev/null", O_WRONLY)) >= 0) {
+	dup2(fd, fileno(out));
+	close(fd);
+    }
+    else
+	close(fileno(out));
+    out = NULL;
+}
+
+/*****************
+ * Helper routines
+ *****************/
+
+/*
+ * resolve - look up the next allocator. dlsym may call calloc, which is
+ *     served from boot_buf meanwhile.
+ */
+static void resolve(void)
+{
+    resolving = 1;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    real_usable_size = dlsym(RTLD_NEXT, "malloc_usable_size");
+    resolving = 0;
+    if (real_malloc == NULL || real_calloc == NULL || real_realloc == NULL ||
+	real_free == NULL || real_usable_size == NULL) {
+	fprintf(stderr, "mmcapture: can't find the next malloc\n");
+	_exit(1);
+    }
+}
+
+/*
+ * wrap - fill in the header of a block whose payload starts offset bytes
+ *     into base, record it if asked to, and return the payload
+ */
+static void *wrap(char *base, size_t offset, size_t size, int rec)
+{
+    char *p;
+
+    if (base == NULL)
+	return NULL;
+    p = base + offset;
+    HDR(p)->offset = offset;
+    HDR(p)->id = -1;
+    if (rec && size > 0 && size <= INT_MAX &&
+	__atomic_load_n(&recording, __ATOMIC_RELAXED) && !in_shim &&
+	(HDR(p)->id = new_id()) >= 0)
+	record('a', HDR(p)->id, size);
+    return p;
+}
+
+/*
+ * record - append a request to this thread's ring. Waits for the writer
+ *     if the ring is full, so no request is ever lost.
+ */
+static void record(char type, int64_t id, size_t size)
+{
+    ring_t *r;
+    event_t *ev;
+    uint64_t seq;
+
+    if (in_shim || !__atomic_load_n(&recording, __ATOMIC_RELAXED))
+	return;
+    if ((r = my_ring) == NULL && (r = get_ring()) == NULL)
+	return;
+    while (r->tail - __atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == RING_SIZE)
+	sched_yield();
+
+    seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_SEQ_CST);
+    ev = &r->ev[r->tail % RING_SIZE];
+    ev->seq = seq;
+    ev->id = id;
+    ev->size = size;
+    ev->type = type;
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * new_id - an id for a new block: a free one of this thread, a batch
+ *     from the shared pool, or a fresh one. Returns -1 and stops
+ *     recording when there are no ids left.
+ */
+static int64_t new_id(void)
+{
+    int64_t id;
+
+    if (my_id_count == 0)
+	pool_move(0);
+    if (my_id_count > 0)
+	return my_ids[--my_id_count];
+
+    id = __atomic_fetch_add(&next_id, 1, __ATOMIC_RELAXED);
+    if (id < INT_MAX)
+	return id;
+    if (id == INT_MAX) {
+	in_shim = 1;
+	fprintf(stderr, "mmcapture: ran out of trace ids, stopped recording\n");
+	in_shim = 0;
+	stop_recording();
+    }
+    return -1;
+}
+
+/*
+ * release_id - make the id of a block whose free was just recorded
+ *     available again. Ids aren't reused once recording has stopped.
+ */
+static void release_id(int64_t id)
+{
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED))
+	return;
+    if (my_id_count == ID_CACHE)
+	pool_move(1);
+    my_ids[my_id_count++] = id;
+}
+
+/*
+ * pool_move - move up to ID_BATCH free ids from this thread's stack to
+ *     the shared pool (to_pool set) or back. If the pool can't grow, the
+ *     ids are dropped.
+ */
+static void pool_move(int to_pool)
+{
+    int32_t *p;
+    size_t n, size;
+
+    pthread_mutex_lock(&pool_lock);
+    if (to_pool) {
+	n = my_id_count < ID_BATCH ? my_id_count : ID_BATCH;
+	if (pool_count + n > pool_size) {
+	    size = pool_size ? 2 * pool_size : POOL_MIN;
+	    p = pool ? mremap(pool, pool_size * sizeof(int32_t),
+			      size * sizeof(int32_t), MREMAP_MAYMOVE)
+		: mmap(NULL, size * sizeof(int32_t), PROT_READ | PROT_WRITE,
+		       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	    if (p != MAP_FAILED) {
+		pool = p;
+		pool_size = size;
+	    }
+	}
+	if (pool_count + n <= pool_size) {
+	    memcpy(pool + pool_count, my_ids + my_id_count - n,
+		   n * sizeof(int32_t));
+	    pool_count += n;
+	}
+	my_id_count -= n;
+    }
+    else {
+	n = pool_count < ID_BATCH ? pool_count : ID_BATCH;
+	pool_count -= n;
+	memcpy(my_ids + my_id_count, pool + pool_count, n * sizeof(int32_t));
+	my_id_count += n;
+    }
+    pthread_mutex_unlock(&pool_lock);
+}
+
+/*
+ * get_ring - give this thread a ring: one left by an exited thread and
+ *     already drained, or a new one
+ */
+static ring_t *get_ring(void)
+{
+    ring_t *r;
+    int state;
+
+    in_shim = 1;
+    for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r != NULL; r = r->next) {
+	state = RING_FREE;
+	if (__atomic_compare_exchange_n(&r->state, &state, RING_OWNED, 0,
+					__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	    break;
+    }
+    if (r == NULL) {
+	r = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE,
+		 MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (r == MAP_FAILED) {
+	    in_shim = 0;
+	    return NULL;
+	}
+	r->state = RING_OWNED;
+	r->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&rings, &r->next, r, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+	    ;
+    }
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    in_shim = 0;
+    return r;
+}
+
+/*
+ * release_ring - thread exit destructor. Gives the thread's free ids to
+ *     the pool; the writer hands the ring to a new thread once it has
+ *     drained it.
+ */
+static void release_ring(void *ring)
+{
+    while (my_id_count > 0)
+	pool_move(1);
+    my_ring = NULL;
+    __atomic_store_n(&((ring_t *)ring)->state, RING_DEAD, __ATOMIC_RELEASE);
+}
+
+/*
+ * write_trace - writer thread. Moves requests from the rings into a
+ *     window indexed by sequence number and writes out the window in
+ *     order. A ring's requests are in sequence order, so the request the
+ *     window waits for is always at the head of some ring, and skipping
+ *     requests that don't fit the window can't stall the writer.
+ */
+static void *write_trace(void *arg)
+{
+    event_t *window;
+    ring_t *r;
+    event_t *ev;
+    uint64_t head, tail, seq = 0;
+    int64_t max_id = -1;
+    int moved;
+    struct timespec nap = {0, 1000000};
+
+    in_shim = 1;
+    window = mmap(NULL, WINDOW_SIZE * sizeof(event_t), PROT_READ | PROT_WRITE,
+		  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (window == MAP_FAILED) {
+	recording = 0;
+	return NULL;
+    }
+    memset(window, 0xff, WINDOW_SIZE * sizeof(event_t)); /* seq = -1 */
+
+    for (;;) {
+	moved = 0;
+	for (r = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); r; r = r->next) {
+	    /* Read the state first: a dead ring's tail is final */
+	    int dead = __atomic_load_n(&r->state, __ATOMIC_ACQUIRE) == RING_DEAD;
+
+	    head = r->head;
+	    tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	    for (; head != tail; head++, moved++) {
+		ev = &r->ev[head % RING_SIZE];
+		if (ev->seq >= seq + WINDOW_SIZE)
+		    break;
+		window[ev->seq % WINDOW_SIZE] = *ev;
+	    }
+	    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+	    if (dead && head == tail)
+		__atomic_store_n(&r->state, RING_FREE, __ATOMIC_RELEASE);
+	}
+
+	for (ev = &window[seq % WINDOW_SIZE];
+	     ev->seq == seq && seq < __atomic_load_n(&end_seq, __ATOMIC_ACQUIRE);
+	     ev = &window[seq % WINDOW_SIZE]) {
+	    if (ev->type == 'f') {
+		fprintf(out, "f %d\n", ev->id);
+	    }
+	    else {
+		fprintf(out, "%c %d %u\n", ev->type, ev->id, ev->size);
+		max_id = ev->id > max_id ? ev->id : max_id;
+	    }
+	    seq++;
+	}
+
+	if (seq >= __atomic_load_n(&end_seq, __ATOMIC_ACQUIRE))
+	    break;
+	if (!moved)
+	    nanosleep(&nap, NULL);
+    }
+
+    /* Fill in the header: heap size (unused), ids, requests, weight */
+    fflush(out);
+    rewind(out);
+    fprintf(out, "%*d\n%*lld\n%*llu\n%*d\n", HDR_WIDTH, 0,
+	    HDR_WIDTH, (long long)max_id + 1,
+	    HDR_WIDTH, (unsigned long long)seq, HDR_WIDTH, 1);
+    munmap(window, WINDOW_SIZE * sizeof(event_t));
+    return NULL;
+}
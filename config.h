@@ -62,11 +62,33 @@
  */
 #define MAX_HEAP (20*(1<<20))  /* 20 MB */
 
+/*
+ * Heap model used by memlib.c. If 0, the heaps live in one malloc'ed
+ * buffer of NUM_HEAPS * MAX_HEAP bytes. If 1, memlib reserves that much
+ * address space with mmap(PROT_NONE), commits pages as mem_sbrk grows
+ * each heap, and gives pages back to the system in mem_trim after a
+ * heap shrinks.
+ */
+#define USE_MMAP_HEAP 1
+
+/*
+ * Number of disjoint heaps memlib manages, each up to MAX_HEAP bytes.
+ * mem_sbrk() grows heap 0; mem_sbrk_at() grows any of them. A
+ * multithreaded malloc package can give each arena its own heap, so
+ * only the MM_THREADS build has more than one (160 MB in all).
+ */
+#ifdef MM_THREADS
+#define NUM_HEAPS 8
+#else
+#define NUM_HEAPS 1
+#endif
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
 #define USE_FCYC   0   /* cycle counter w/K-best scheme (x86 & Alpha only) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
-#define USE_GETTOD 1   /* gettimeofday (any Unix box) */
+#define USE_GETTOD 0   /* gettimeofday (any Unix box) */
+#define USE_CLOCK  1   /* invariant TSC or clock_gettime, adaptive reps */
 
 #endif /* __CONFIG_H */
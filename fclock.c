@@ -0,0 +1,187 @@
+/*
+ * fclock.c - Estimate the time (in seconds) used by a function f with
+ *     adaptive repetition (see fclock.h)
+ *
+ * On x86-64 CPUs with an invariant TSC (constant rate, running in all
+ * power states) runs are timed with fenced rdtsc/rdtscp reads, and the
+ * TSC rate is calibrated against CLOCK_MONOTONIC_RAW once at startup.
+ * Anywhere else clock_gettime(CLOCK_MONOTONIC_RAW) is read directly.
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+#include "fclock.h"
+
+/* Parameters set by the set_fclock_xxx routines */
+static double target = 0.01;
+static int min_reps = 10;
+static int max_reps = 1000;
+static double max_secs = 1.0;
+
+static int use_tsc = 0;        /* time with the TSC? */
+static double secs_per_tick;   /* length of one clock tick */
+
+/* 97.5% quantiles of Student's t with 1..30 degrees of freedom */
+static double t975[] = {
+    12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+    2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+    2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+};
+
+/* Nanoseconds of CLOCK_MONOTONIC_RAW */
+static uint64_t raw_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/*
+ * start_ticks and end_ticks read the clock before and after the timed
+ * code. The fences keep the TSC reads from being reordered with it:
+ * rdtsc can't start before earlier instructions finish, and later
+ * instructions can't start before rdtscp has read the counter.
+ */
+static inline uint64_t start_ticks(void)
+{
+#if defined(__x86_64__)
+    uint64_t t;
+
+    if (use_tsc) {
+	_mm_lfence();
+	t = __rdtsc();
+	_mm_lfence();
+	return t;
+    }
+#endif
+    return raw_ns();
+}
+
+static inline uint64_t end_ticks(void)
+{
+#if defined(__x86_64__)
+    uint64_t t;
+    unsigned aux;
+
+    if (use_tsc) {
+	t = __rdtscp(&aux);
+	_mm_lfence();
+	return t;
+    }
+#endif
+    return raw_ns();
+}
+
+/*
+ * init_fclock - use the TSC if it is invariant and rdtscp exists, and
+ *     calibrate it over a 50 ms sleep. Each clock_gettime call is
+ *     bracketed by TSC reads so its TSC time is known to within the
+ *     length of the call.
+ */
+double init_fclock(void)
+{
+#if defined(__x86_64__)
+    unsigned eax, ebx, ecx, edx;
+    uint64_t a0, a1, b0, b1, ns0, ns1;
+    struct timespec nap = {0, 50000000};
+
+    if (__get_cpuid(0x80000001, &eax, &ebx, &ecx, &edx) &&
+	(edx & (1 << 27)) &&                               /* rdtscp */
+	__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) &&
+	(edx & (1 << 8))) {                                /* invariant */
+	a0 = __rdtsc();
+	ns0 = raw_ns();
+	a1 = __rdtsc();
+	nanosleep(&nap, NULL);
+	b0 = __rdtsc();
+	ns1 = raw_ns();
+	b1 = __rdtsc();
+	use_tsc = 1;
+	secs_per_tick = (ns1 - ns0) * 1e-9 / ((b0 + b1) / 2.0 - (a0 + a1) / 2.0);
+	return 1.0 / secs_per_tick;
+    }
+#endif
+    use_tsc = 0;
+    secs_per_tick = 1e-9;
+    return 0;
+}
+
+/*
+ * fclock - see fclock.h. The mean and variance are accumulated with
+ *     Welford's method.
+ */
+double fclock(fclock_test_funct f, void *argp, fclock_stats_t *stats)
+{
+    uint64_t t0, t1;
+    double x, delta, mean = 0, m2 = 0, sd = 0, ci = 0, min = 0, total = 0;
+    int n = 0;
+
+    if (secs_per_tick == 0)
+	init_fclock();
+
+    f(argp); /* warm up caches and page tables */
+    while (n < max_reps) {
+	t0 = start_ticks();
+	f(argp);
+	t1 = end_ticks();
+	x = (t1 - t0) * secs_per_tick;
+
+	n++;
+	delta = x - mean;
+	mean += delta / n;
+	m2 += delta * (x - mean);
+	if (n == 1 || x < min)
+	    min = x;
+	total += x;
+
+	if (n >= 2) {
+	    sd = sqrt(m2 / (n - 1));
+	    ci = (n <= 31 ? t975[n - 2] : 1.96) * sd / sqrt(n);
+	}
+	if (n >= min_reps && (ci <= target * mean || total >= max_secs))
+	    break;
+    }
+
+    if (stats) {
+	stats->reps = n;
+	stats->mean = mean;
+	stats->sd = sd;
+	stats->ci = ci;
+	stats->min = min;
+    }
+    return mean;
+}
+
+double fclock_run(fclock_test_funct f, void *argp)
+{
+    uint64_t t0, t1;
+
+    if (secs_per_tick == 0)
+	init_fclock();
+    t0 = start_ticks();
+    f(argp);
+    t1 = end_ticks();
+    return (t1 - t0) * secs_per_tick;
+}
+
+void set_fclock_target(double target_arg)
+{
+    target = target_arg;
+}
+
+void set_fclock_reps(int min, int max)
+{
+    min_reps = min < 2 ? 2 : min;
+    max_reps = max < min_reps ? min_reps : max;
+}
+
+void set_fclock_maxsecs(double secs)
+{
+    max_secs = secs;
+}
@@ -0,0 +1,66 @@
+/*
+ * fclock.h - prototypes for the routines in fclock.c that estimate the
+ *     time in seconds used by a test function f, using the invariant
+ *     TSC on x86-64 or clock_gettime(CLOCK_MONOTONIC_RAW) elsewhere
+ */
+#ifndef __FCLOCK_H_
+#define __FCLOCK_H_
+
+/* The test function takes a generic pointer as input */
+typedef void (*fclock_test_funct)(void *);
+
+/* Summarizes the timed runs behind one fclock result */
+typedef struct {
+    int reps;     /* number of timed runs */
+    double mean;  /* mean secs per run */
+    double sd;    /* standard deviation of the secs per run */
+    double ci;    /* half width of the 95% confidence interval of mean */
+    double min;   /* secs of the fastest run */
+} fclock_stats_t;
+
+/*
+ * init_fclock - pick the clock and calibrate the TSC against
+ *     CLOCK_MONOTONIC_RAW. Returns the TSC frequency in Hz, or 0 if
+ *     clock_gettime is used instead.
+ */
+double init_fclock(void);
+
+/*
+ * fclock - Run f(argp) once to warm up, then time it until the 95%
+ *     confidence interval of the mean is within the target, the
+ *     maximum number of runs is reached, or the time budget is spent.
+ *     Returns the mean secs per run, and fills in stats if not NULL.
+ */
+double fclock(fclock_test_funct f, void *argp, fclock_stats_t *stats);
+
+/*
+ * fclock_run - Return the secs of a single run of f(argp), without
+ *     warming up
+ */
+double fclock_run(fclock_test_funct f, void *argp);
+
+/*********************************************************
+ * Set the various parameters used by measurement routines
+ *********************************************************/
+
+/*
+ * set_fclock_target - Target half width of the confidence interval,
+ *     relative to the mean
+ *     Default = 0.01
+ */
+void set_fclock_target(double target);
+
+/*
+ * set_fclock_reps - Minimum and maximum number of timed runs
+ *     Default = 10, 1000
+ */
+void set_fclock_reps(int min, int max);
+
+/*
+ * set_fclock_maxsecs - Stop after this many secs of timed runs, once
+ *     the minimum number of runs is done
+ *     Default = 1.0
+ */
+void set_fclock_maxsecs(double secs);
+
+#endif /* __FCLOCK_H_ */
@@ -6,9 +6,11 @@
 #include "fcyc.h"
 #include "clock.h"
 #include "ftimer.h"
+#include "fclock.h"
 #include "config.h"
 
 static double Mhz;  /* estimated CPU clock frequency */
+static fclock_stats_t last; /* runs behind the last fsecs result */
 
 extern int verbose; /* -v option in mdriver.c */
 
@@ -36,6 +38,18 @@ void init_fsecs(void)
 #elif USE_GETTOD
     if (verbose)
 	printf("Measuring performance with gettimeofday().\n");
+#elif USE_CLOCK
+    /* repeat each trace until the mean is known to within 1% */
+    set_fclock_target(0.01);
+    set_fclock_reps(10, 1000);
+    set_fclock_maxsecs(1.0);
+    Mhz = init_fclock() / 1e6;
+    if (verbose) {
+	if (Mhz > 0)
+	    printf("Measuring performance with the TSC (%.1f MHz).\n", Mhz);
+	else
+	    printf("Measuring performance with clock_gettime().\n");
+    }
 #endif
 }
 
@@ -51,7 +65,42 @@ double fsecs(fsecs_test_funct f, void *argp)
     return ftimer_itimer(f, argp, 10);
 #elif USE_GETTOD
     return ftimer_gettod(f, argp, 10);
+#elif USE_CLOCK
+    return fclock(f, argp, &last);
 #endif 
 }
 
+/*
+ * fsecs_method - Name the timing method, and set *mhz to the frequency
+ *     of the cycle counter it uses, or 0 if it doesn't use one
+ */
+char *fsecs_method(double *mhz)
+{
+    *mhz = Mhz;
+#if USE_FCYC
+    return "fcyc";
+#elif USE_ITIMER
+    return "itimer";
+#elif USE_GETTOD
+    return "gettimeofday";
+#elif USE_CLOCK
+    return Mhz > 0 ? "tsc" : "clock_gettime";
+#endif
+}
+
+/*
+ * fsecs_stats - Describe the runs behind the last fsecs result. Returns
+ *     0 if the timing method doesn't measure their spread.
+ */
+int fsecs_stats(fclock_stats_t *stats)
+{
+#if USE_CLOCK
+    *stats = last;
+    return 1;
+#else
+    (void)last;
+    return 0;
+#endif
+}
+
 
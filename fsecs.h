@@ -1,4 +1,8 @@
+#include "fclock.h"
+
 typedef void (*fsecs_test_funct)(void *);
 
 void init_fsecs(void);
 double fsecs(fsecs_test_funct f, void *argp);
+int fsecs_stats(fclock_stats_t *stats);
+char *fsecs_method(double *mhz);
@@ -0,0 +1,85 @@
+/*
+ * hist.c - Log-linear latency histograms (see hist.h)
+ */
+#include <string.h>
+#include <time.h>
+
+#include "hist.h"
+
+/*
+ * hist_reset - clear all recorded values
+ */
+void hist_reset(hist_t *h)
+{
+    memset(h, 0, sizeof(hist_t));
+}
+
+/*
+ * hist_merge - add the values recorded in src to dst
+ */
+void hist_merge(hist_t *dst, hist_t *src)
+{
+    int i;
+
+    for (i = 0; i < HIST_BUCKETS; i++)
+	dst->buckets[i] += src->buckets[i];
+    dst->count += src->count;
+    if (src->max > dst->max)
+	dst->max = src->max;
+}
+
+/*
+ * hist_percentile - the value that pct percent of the recorded values
+ *     are at or below. Reports the top of the bucket it falls in, but
+ *     never more than the largest recorded value.
+ */
+uint64_t hist_percentile(hist_t *h, double pct)
+{
+    uint64_t rank, seen = 0, top;
+    int i, shift;
+
+    if (h->count == 0)
+	return 0;
+    rank = (uint64_t)(pct / 100.0 * h->count + 0.5);
+    if (rank < 1)
+	rank = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += h->buckets[i];
+	if (seen >= rank)
+	    break;
+    }
+    if (i < 2 * HIST_SUB)
+	top = i;
+    else {
+	shift = i / HIST_SUB - 1;
+	top = ((uint64_t)(HIST_SUB + i % HIST_SUB + 1) << shift) - 1;
+    }
+    return top < h->max ? top : h->max;
+}
+
+/*
+ * hist_ticks_per_ns - how many hist_ticks make a nanosecond. Measured
+ *     once against CLOCK_MONOTONIC over about 20 ms.
+ */
+double hist_ticks_per_ns(void)
+{
+    static double rate = 0;
+    struct timespec start, end, nap = {0, 20000000};
+    uint64_t t0, t1;
+
+    if (rate > 0)
+	return rate;
+#if defined(__x86_64__) || defined(__i386__)
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    t0 = hist_ticks();
+    nanosleep(&nap, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    t1 = hist_ticks();
+    rate = (double)(t1 - t0) /
+	((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec));
+#else
+    (void)start; (void)end; (void)nap; (void)t0; (void)t1;
+    rate = 1.0;
+#endif
+    return rate;
+}
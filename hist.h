@@ -0,0 +1,71 @@
+/*
+ * hist.h - Log-linear latency histograms and a cheap tick counter
+ *
+ * A histogram keeps HIST_SUB linear buckets for every power of two, in
+ * the style of HdrHistogram, so any recorded value is known to within
+ * 1/HIST_SUB (about 3%) while the whole 64-bit range fits in a fixed
+ * array. Values are in ticks of hist_ticks(): TSC cycles on x86, or
+ * nanoseconds elsewhere. hist_ticks_per_ns converts them for printing.
+ */
+#ifndef __HIST_H_
+#define __HIST_H_
+
+#include <stdint.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+#define HIST_SUB_BITS 5
+#define HIST_SUB (1 << HIST_SUB_BITS)           /* buckets per power of 2 */
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;                 /* number of recorded values */
+    uint64_t max;                   /* largest recorded value */
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void hist_reset(hist_t *h);
+void hist_merge(hist_t *dst, hist_t *src);
+uint64_t hist_percentile(hist_t *h, double pct);
+double hist_ticks_per_ns(void);
+
+/*
+ * hist_bucket - bucket of value v. Values below 2*HIST_SUB get a bucket
+ *     each; above that, v is bucketed by its top HIST_SUB_BITS+1 bits.
+ */
+static inline int hist_bucket(uint64_t v)
+{
+    int shift;
+
+    if (v < 2 * HIST_SUB)
+	return (int)v;
+    shift = 63 - __builtin_clzll(v) - HIST_SUB_BITS;
+    return (shift + 1) * HIST_SUB + (int)(v >> shift) - HIST_SUB;
+}
+
+/* hist_add - record value v */
+static inline void hist_add(hist_t *h, uint64_t v)
+{
+    h->buckets[hist_bucket(v)]++;
+    h->count++;
+    if (v > h->max)
+	h->max = v;
+}
+
+/* hist_ticks - current time in ticks, for measuring short intervals */
+static inline uint64_t hist_ticks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
+
+#endif /* __HIST_H_ */
@@ -14,12 +14,69 @@
 #include <string.h>
 #include <assert.h>
 #include <float.h>
+#include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "stream.h"
+#include "hist.h"
+#include "perfctr.h"
+#include "buildinfo.h"
+
+#ifdef MM_AB
+/*
+ * An A/B build (make mdriver-ab) links two malloc packages whose
+ * mm_* functions and team are renamed to mmA_* and mmB_*. Calls to the
+ * mm_* names go through mm_cur, which points at the package being
+ * evaluated; it is A except during the -b comparison.
+ */
+#ifndef MM_A_NAME
+#define MM_A_NAME "A"
+#endif
+#ifndef MM_B_NAME
+#define MM_B_NAME "B"
+#endif
+
+typedef struct {
+    char *name;                          /* source file of the package */
+    int (*init)(void);
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    team_t *team;
+} mm_impl_t;
+
+extern int mmA_init(void), mmB_init(void);
+extern void *mmA_malloc(size_t size), *mmB_malloc(size_t size);
+extern void mmA_free(void *ptr), mmB_free(void *ptr);
+extern void *mmA_realloc(void *ptr, size_t size);
+extern void *mmB_realloc(void *ptr, size_t size);
+extern team_t mmA_team, mmB_team;
+
+static mm_impl_t mm_impls[2] = {
+    {MM_A_NAME, mmA_init, mmA_malloc, mmA_free, mmA_realloc, &mmA_team},
+    {MM_B_NAME, mmB_init, mmB_malloc, mmB_free, mmB_realloc, &mmB_team},
+};
+static mm_impl_t *mm_cur = &mm_impls[0];
+static int ab_running = 0; /* name the package in errors during -b */
+
+#define mm_init() (mm_cur->init())
+#define mm_malloc(size) (mm_cur->malloc(size))
+#define mm_free(ptr) (mm_cur->free(ptr))
+#define mm_realloc(ptr, size) (mm_cur->realloc((ptr), (size)))
+#define team (*mm_cur->team)
+#endif
 
 /**********************
  * Constants and macros
@@ -30,26 +87,43 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Timed runs of each thread count in -j mode; the fastest one is kept */
+#define JOB_REPS       3
+
+/* Request types that -L keeps a latency histogram for */
+#define NUM_OPTYPES    3
+
+/* Formats of the -o results */
+#define OUT_JSON       1
+#define OUT_CSV        2
+
+/* Bootstrap resamples for the -b confidence intervals */
+#define AB_RESAMPLES 2000
+
+/* Number of range records allocated at once for the range pool */
+#define RANGE_CHUNK 4096
+
 /* Returns true if p is ALIGNMENT-byte aligned */
-#define IS_ALIGNED(p)  ((((unsigned int)(p)) % ALIGNMENT) == 0)
+#define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
 /****************************** 
  * The key compound data types 
  *****************************/
 
-/* Records the extent of each block's payload */
+/* 
+ * Records the extent of each block's payload. The ranges of one trace
+ * form a treap: a binary search tree ordered by lo that is also a heap
+ * on the random prio, so it stays balanced in expectation.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* subtree with lower addresses */
+    struct range_t *right; /* subtree with higher addresses (or next free) */
+    unsigned prio;         /* random treap priority */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum {ALLOC, FREE, REALLOC} type; /* type of request */
-    int index;                        /* index for free() to use later */
-    int size;                         /* byte size of alloc/realloc request */
-} traceop_t;
+/* A single trace operation (traceop_t) is defined in trace.h */
 
 /* Holds the information for one trace file*/
 typedef struct {
@@ -60,6 +134,8 @@ typedef struct {
     traceop_t *ops;      /* array of requests */
     char **blocks;       /* array of ptrs returned by malloc/realloc... */
     size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mmap of a binary trace file that ops points */
+    size_t map_size;     /*   into, or NULL for a text trace */
 } trace_t;
 
 /* 
@@ -78,13 +154,53 @@ typedef struct {
     double ops;      /* number of ops (malloc/free/realloc) in the trace */
     int valid;       /* was the trace processed correctly by the allocator? */
     double secs;     /* number of secs needed to run the trace */
+    int reps;        /* timed runs behind secs, or 0 if not known */
+    double sd;       /* standard deviation of the secs of one run */
+    double ci;       /* half width of the 95% confidence interval of secs */
 
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
+    size_t heapsize; /* peak heap footprint of the utilization run */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t; 
 
+#ifdef MM_AB
+/* The -b measurements of one trace for both packages */
+typedef struct {
+    int valid;         /* was the trace correct with both packages? */
+    double ops;        /* number of ops in the trace */
+    double util[2];    /* space utilization of A and B */
+    double *secs[2];   /* secs of each interleaved run of A and B */
+} ab_stats_t;
+#endif
+
+#ifdef MM_THREADS
+/* 
+ * Holds the params and results of one replay thread in -j mode. Every
+ * thread replays the whole trace with its own blocks arrays, so the
+ * threads use disjoint ids: thread t's id i is global id t*num_ids+i.
+ */
+typedef struct {
+    trace_t *trace;      /* trace shared by all threads (ops only) */
+    int tracenum;        /* trace number, for error messages */
+    int thread;          /* thread number, selects the id space */
+    int check;           /* if set, check every request like eval_mm_valid */
+    char **blocks;       /* this thread's ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and their payload sizes */
+    int valid;           /* did this thread see only correct results? */
+    double start;        /* gettimeofday secs when the replay started... */
+    double end;          /* ... and when it finished */
+} replay_t;
+
+/* Summarizes a run of the same trace on some number of threads */
+typedef struct {
+    double ops;      /* ops done by all threads together */
+    double secs;     /* wall time from the first start to the last end */
+    double thr_kops; /* average Kops of a single thread */
+} job_stats_t;
+#endif
+
 /********************
  * Global variables
  *******************/
@@ -95,24 +211,39 @@ char msg[MAXLINE];      /* for whenever we need to compose an error message */
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
 
+/* Unused range records, linked through their right pointers */
+static range_t *range_pool = NULL;
+static unsigned range_seed = 1; /* state of the treap priority generator */
+
 /* The filenames of the default tracefiles */
 static char *default_tracefiles[] = {  
     DEFAULT_TRACEFILES, NULL
 };
 
+#ifdef MM_THREADS
+/* Range tree shared by the threads of a checked -j replay */
+static range_t *job_ranges = NULL;
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_barrier_t job_barrier;
+#endif
+
 
 /********************* 
  * Function prototypes 
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum);
+		     int tracenum, long opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static range_t *find_range(range_t *root, char *addr);
+static void split_ranges(range_t *root, char *lo, range_t **l, range_t **r);
+static range_t *merge_ranges(range_t *l, range_t *r);
 
 /* These functions read, allocate, and free storage for traces */
 static trace_t *read_trace(char *tracedir, char *filename);
+static void map_trace(trace_t *trace, char *path);
 static void free_trace(trace_t *trace);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
@@ -124,12 +255,41 @@ static void eval_libc_speed(void *ptr);
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_latency(trace_t *trace, hist_t *lat);
+
+/* Streaming versions of the above for traces that don't fit in memory */
+static void eval_mm_stream(char *tracedir, char *filename, int tracenum,
+			   range_t **ranges, stats_t *stats);
+static int stream_mm_pass(char *path, int tracenum, range_t **ranges,
+			  int check, stats_t *stats);
+
+#ifdef MM_THREADS
+/* Routines for replaying a trace on several threads at once (-j) */
+static int eval_mm_threads(trace_t *trace, int tracenum, int nthreads,
+			   int check, job_stats_t *stats);
+static void *replay_thread(void *ptr);
+static void print_job_results(int n, int jobs, job_stats_t *stats);
+#endif
 
 /* Various helper routines */
+#ifdef MM_AB
+static void eval_mm_ab(trace_t *trace, int tracenum, int reps,
+		       range_t **ranges, ab_stats_t *stats);
+static void print_ab_results(int n, int reps, ab_stats_t *stats);
+static unsigned ab_rand(void);
+static void ab_ci(double *samples, double *lo, double *hi);
+#endif
+static void get_spread(stats_t *stats);
+static void write_json(FILE *fp, int n, char **tracefiles, stats_t *stats,
+		       hist_t *lat, perfctr_vals_t *ctrs, double perfindex);
+static void write_csv(FILE *fp, int n, char **tracefiles, stats_t *stats,
+		      hist_t *lat, perfctr_vals_t *ctrs);
 static void printresults(int n, stats_t *stats);
+static void print_latency_results(int n, stats_t *stats, hist_t *lat);
+static void print_ctr_results(int n, stats_t *stats, perfctr_vals_t *ctrs);
 static void usage(void);
 static void unix_error(char *msg);
-static void malloc_error(int tracenum, int opnum, char *msg);
+static void malloc_error(int tracenum, long opnum, char *msg);
 static void app_error(char *msg);
 
 /**************
@@ -142,7 +302,7 @@ int main(int argc, char **argv)
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
     trace_t *trace = NULL;     /* stores a single trace file in memory */
-    range_t *ranges = NULL;    /* keeps track of block extents for one trace */
+    range_t *ranges = NULL;    /* tree of block extents for one trace */
     stats_t *libc_stats = NULL;/* libc stats for each trace */
     stats_t *mm_stats = NULL;  /* mm (i.e. student) stats for each trace */
     speed_t speed_params;      /* input parameters to the xx_speed routines */ 
@@ -150,6 +310,16 @@ int main(int argc, char **argv)
     int team_check = 1;  /* If set, check team structure (reset by -a) */
     int run_libc = 0;    /* If set, run libc malloc (set by -l) */
     int autograder = 0;  /* If set, emit summary info for autograder (-g) */
+    int jobs = 0;        /* If set, also replay on 1..jobs threads (-j) */
+    int stream = 0;      /* If set, stream the traces through mm (-s) */
+    int latency = 0;     /* If set, time every request of mm (-L) */
+    int counters = 0;    /* If set, read hardware counters for mm (-P) */
+    int ab_reps = 0;     /* If set, compare packages A and B (-b) */
+    perfctr_t pc;              /* the counters opened for -P */
+    perfctr_vals_t *mm_ctrs = NULL; /* mm counter values for each trace */
+    hist_t *lat = NULL;        /* -L histograms of each trace and op type */
+    int outfmt = 0;            /* format of the -o results, if any */
+    FILE *results = NULL;      /* where the -o results go */
 
     /* temporaries used to compute the performance index */
     double secs, ops, util, avg_mm_util, avg_mm_throughput, p1, p2, perfindex;
@@ -158,7 +328,7 @@ int main(int argc, char **argv)
     /* 
      * Read and interpret the command line arguments 
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "f:t:hvVgalj:sLPb:o:")) != EOF) {
         switch (c) {
 	case 'g': /* Generate summary info for the autograder */
 	    autograder = 1;
@@ -184,6 +354,47 @@ int main(int argc, char **argv)
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'j': /* Replay each trace on 1..n threads at once */
+	    jobs = atoi(optarg);
+	    if (jobs < 1) {
+		usage();
+		exit(1);
+	    }
+#ifndef MM_THREADS
+	    printf("ERROR: -j needs a thread-safe build (make THREADS=1)\n");
+	    exit(1);
+#endif
+	    break;
+        case 'b': /* Compare packages A and B over n interleaved runs */
+	    ab_reps = atoi(optarg);
+	    if (ab_reps < 2) {
+		usage();
+		exit(1);
+	    }
+#ifndef MM_AB
+	    printf("ERROR: -b needs an A/B build (make mdriver-ab)\n");
+	    exit(1);
+#endif
+	    break;
+        case 'o': /* Write machine-readable results to stdout */
+	    if (!strcmp(optarg, "json"))
+		outfmt = OUT_JSON;
+	    else if (!strcmp(optarg, "csv"))
+		outfmt = OUT_CSV;
+	    else {
+		usage();
+		exit(1);
+	    }
+	    break;
+        case 's': /* Stream traces instead of loading them */
+            stream = 1;
+            break;
+        case 'L': /* Print per-request latency percentiles */
+            latency = 1;
+            break;
+        case 'P': /* Print hardware counters of the timed runs */
+            counters = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -199,6 +410,22 @@ int main(int argc, char **argv)
         }
     }
 	
+    if (stream && (latency || counters)) {
+	printf("ERROR: -L and -P need the whole trace in memory, so they can't be used with -s\n");
+	exit(1);
+    }
+
+    /*
+     * With -o, the results are the only thing written to stdout; all
+     * the usual output goes to stderr instead
+     */
+    if (outfmt) {
+	fflush(stdout);
+	if ((results = fdopen(dup(STDOUT_FILENO), "w")) == NULL ||
+	    dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+	    unix_error("ERROR: can't redirect stdout for -o");
+    }
+
     /* 
      * Check and print team info 
      */
@@ -262,6 +489,7 @@ int main(int argc, char **argv)
 		if (verbose > 1)
 		    printf("and performance.\n");
 		libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+		get_spread(&libc_stats[i]);
 	    }
 	    free_trace(trace);
 	}
@@ -284,11 +512,26 @@ int main(int argc, char **argv)
     if (mm_stats == NULL)
 	unix_error("mm_stats calloc in main failed");
     
+    /* Open the hardware counters, or go on without them */
+    if (counters) {
+	if (perfctr_open(&pc) == 0) {
+	    printf("Hardware counters are not available here, ignoring -P\n");
+	    counters = 0;
+	}
+	else if ((mm_ctrs = (perfctr_vals_t *)calloc(num_tracefiles,
+		 sizeof(perfctr_vals_t))) == NULL)
+	    unix_error("mm_ctrs calloc in main failed");
+    }
+
     /* Initialize the simulated memory system in memlib.c */
     mem_init(); 
 
     /* Evaluate student's mm malloc package using the K-best scheme */
     for (i=0; i < num_tracefiles; i++) {
+	if (stream) {
+	    eval_mm_stream(tracedir, tracefiles[i], i, &ranges, &mm_stats[i]);
+	    continue;
+	}
 	trace = read_trace(tracedir, tracefiles[i]);
 	mm_stats[i].ops = trace->num_ops;
 	if (verbose > 1)
@@ -298,11 +541,20 @@ int main(int argc, char **argv)
 	    if (verbose > 1)
 		printf("efficiency, ");
 	    mm_stats[i].util = eval_mm_util(trace, i, &ranges);
+	    mm_stats[i].heapsize = mem_peak_footprint();
 	    speed_params.trace = trace;
 	    speed_params.ranges = ranges;
 	    if (verbose > 1)
 		printf("and performance.\n");
 	    mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
+	    get_spread(&mm_stats[i]);
+
+	    /* One more run of eval_mm_speed under the counters */
+	    if (counters) {
+		perfctr_start(&pc);
+		eval_mm_speed(&speed_params);
+		perfctr_stop(&pc, &mm_ctrs[i]);
+	    }
 	}
 	free_trace(trace);
     }
@@ -314,6 +566,114 @@ int main(int argc, char **argv)
 	printf("\n");
     }
 
+    if (counters) {
+	printf("Hardware counters per request for mm malloc:\n");
+	print_ctr_results(num_tracefiles, mm_stats, mm_ctrs);
+	printf("\n");
+	perfctr_close(&pc);
+    }
+
+    /*
+     * Optionally replay each valid trace once more, timing every
+     * request on its own. This is a separate pass so the timer reads
+     * don't slow down the throughput measured above.
+     */
+    if (latency) {
+	lat = (hist_t *)malloc(num_tracefiles * NUM_OPTYPES * sizeof(hist_t));
+	if (lat == NULL)
+	    unix_error("lat malloc in main failed");
+
+	for (i=0; i < num_tracefiles * NUM_OPTYPES; i++)
+	    hist_reset(&lat[i]);
+	for (i=0; i < num_tracefiles; i++) {
+	    if (!mm_stats[i].valid)
+		continue;
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Timing each request.\n");
+	    eval_mm_latency(trace, &lat[i*NUM_OPTYPES]);
+	    free_trace(trace);
+	}
+
+	printf("\nLatency percentiles for mm malloc (ns):\n");
+	print_latency_results(num_tracefiles, mm_stats, lat);
+	printf("\n");
+    }
+
+#ifdef MM_THREADS
+    /*
+     * Optionally replay each trace on 1..jobs threads at once. The
+     * run on all jobs threads is checked first, then every thread
+     * count is timed without checks.
+     */
+    if (jobs) {
+	job_stats_t *job_stats;
+	int k;
+
+	job_stats = (job_stats_t *)calloc(num_tracefiles * jobs,
+					  sizeof(job_stats_t));
+	if (job_stats == NULL)
+	    unix_error("job_stats calloc in main failed");
+
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    if (verbose > 1)
+		printf("Checking mm_malloc on %d threads, ", jobs);
+	    if (eval_mm_threads(trace, i, jobs, 1, NULL)) {
+		if (verbose > 1)
+		    printf("and scaling.\n");
+		for (k=1; k <= jobs; k++)
+		    eval_mm_threads(trace, i, k, 0, &job_stats[i*jobs + k-1]);
+	    }
+	    free_trace(trace);
+	}
+
+	printf("\nResults for mm malloc on 1..%d threads:\n", jobs);
+	print_job_results(num_tracefiles, jobs, job_stats);
+	printf("\n");
+	free(job_stats);
+    }
+#endif
+
+#ifdef MM_AB
+    /*
+     * Optionally compare packages A and B on every trace. Both are
+     * checked first, then timed in ab_reps rounds of one run each, in
+     * random order within each round.
+     */
+    if (ab_reps) {
+	ab_stats_t *ab_stats;
+	int mm_errors = errors; /* errors of B don't count against A */
+
+	ab_stats = (ab_stats_t *)calloc(num_tracefiles, sizeof(ab_stats_t));
+	if (ab_stats == NULL)
+	    unix_error("ab_stats calloc in main failed");
+
+	ab_running = 1;
+	for (i=0; i < num_tracefiles; i++) {
+	    trace = read_trace(tracedir, tracefiles[i]);
+	    eval_mm_ab(trace, i, ab_reps, &ranges, &ab_stats[i]);
+	    free_trace(trace);
+	}
+	ab_running = 0;
+	mm_cur = &mm_impls[0];
+
+	printf("\nA/B comparison of A = %s and B = %s, %d runs each:\n",
+	       mm_impls[0].name, mm_impls[1].name, ab_reps);
+	print_ab_results(num_tracefiles, ab_reps, ab_stats);
+	if (errors > mm_errors)
+	    printf("%d errors of the A/B runs are left out of the perf index\n",
+		   errors - mm_errors);
+	printf("\n");
+	for (i=0; i < num_tracefiles; i++) {
+	    free(ab_stats[i].secs[0]);
+	    free(ab_stats[i].secs[1]);
+	}
+	free(ab_stats);
+	errors = mm_errors;
+    }
+#endif
+
     /* 
      * Accumulate the aggregate statistics for the student's mm package 
      */
@@ -362,28 +722,44 @@ int main(int argc, char **argv)
 	printf("perfidx:%.0f\n", perfindex);
     }
 
+    if (outfmt == OUT_JSON)
+	write_json(results, num_tracefiles, tracefiles, mm_stats, lat,
+		   mm_ctrs, perfindex);
+    else if (outfmt == OUT_CSV)
+	write_csv(results, num_tracefiles, tracefiles, mm_stats, lat,
+		  mm_ctrs);
+    if (results)
+	fclose(results);
+    free(lat);
+    free(mm_ctrs);
+
     exit(0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps 
+ * The following routines manipulate the range tree, which keeps 
  * track of the extent of every allocated block payload. We use the 
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. The ranges
+ * in a tree never overlap, so a new block overlaps some range iff it
+ * overlaps the range with the highest lo at or below its own hi.
+ * All operations take O(log n) expected time, and the records come
+ * from a pool instead of one malloc per block.
  ****************************************************************/
 
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of 
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list. 
+ *     we take a range record from the pool and add it to the range tree. 
  */
 static int add_range(range_t **ranges, char *lo, int size, 
-		     int tracenum, int opnum)
+		     int tracenum, long opnum)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *l, *r;
     char msg[MAXLINE];
+    int i;
 
     assert(size > 0);
 
@@ -395,9 +771,9 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) || 
-	(hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of one of the heaps, or
+       within a region the package got from mem_map */
+    if (!mem_is_heap(lo, size) && !mem_is_mapped(lo, size)) {
 	sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
 		lo, hi, mem_heap_lo(), mem_heap_hi());
 	malloc_error(tracenum, opnum, msg);
@@ -405,26 +781,35 @@ static int add_range(range_t **ranges, char *lo, int size,
     }
 
     /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-	    sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-		    lo, hi, p->lo, p->hi);
-	    malloc_error(tracenum, opnum, msg);
-	    return 0;
-        }
+    if ((p = find_range(*ranges, hi)) != NULL && p->hi >= lo) {
+	sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+		lo, hi, p->lo, p->hi);
+	malloc_error(tracenum, opnum, msg);
+	return 0;
     }
 
     /* 
      * Everything looks OK, so remember the extent of this block 
-     * by creating a range struct and adding it the range list.
+     * by taking a range record from the pool and adding it to the tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-	unix_error("malloc error in add_range");
-    p->next = *ranges;
+    if (range_pool == NULL) {
+	if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+	    unix_error("malloc error in add_range");
+	for (i = 0; i < RANGE_CHUNK; i++) {
+	    p[i].right = range_pool;
+	    range_pool = &p[i];
+	}
+    }
+    p = range_pool;
+    range_pool = p->right;
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    p->left = p->right = NULL;
+    range_seed = range_seed * 1103515245 + 12345;
+    p->prio = range_seed;
+
+    split_ranges(*ranges, lo, &l, &r);
+    *ranges = merge_ranges(merge_ranges(l, p), r);
     return 1;
 }
 
@@ -434,33 +819,84 @@ static int add_range(range_t **ranges, char *lo, int size,
 static void remove_range(range_t **ranges, char *lo)
 {
     range_t *p;
-    range_t **prevpp = ranges;
-    int size;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-	    *prevpp = p->next;
-            size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *ranges) != NULL && p->lo != lo)
+	ranges = (lo < p->lo) ? &p->left : &p->right;
+    if (p != NULL) {
+	*ranges = merge_ranges(p->left, p->right);
+	p->right = range_pool;
+	range_pool = p;
     }
 }
 
 /*
- * clear_ranges - free all of the range records for a trace 
+ * clear_ranges - return all of the range records for a trace to the pool
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
+
+    if (p == NULL)
+	return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    p->right = range_pool;
+    range_pool = p;
+    *ranges = NULL;
+}
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
+/*
+ * find_range - the range with the highest lo at or below addr, or NULL
+ */
+static range_t *find_range(range_t *root, char *addr)
+{
+    range_t *best = NULL;
+
+    while (root != NULL) {
+	if (root->lo <= addr) {
+	    best = root;
+	    root = root->right;
+	}
+	else
+	    root = root->left;
+    }
+    return best;
+}
+
+/*
+ * split_ranges - split a tree into the ranges below lo (*l) and the 
+ *     ranges at or above lo (*r)
+ */
+static void split_ranges(range_t *root, char *lo, range_t **l, range_t **r)
+{
+    if (root == NULL)
+	*l = *r = NULL;
+    else if (root->lo < lo) {
+	split_ranges(root->right, lo, &root->right, r);
+	*l = root;
+    }
+    else {
+	split_ranges(root->left, lo, l, &root->left);
+	*r = root;
     }
-    *ranges = NULL;
+}
+
+/*
+ * merge_ranges - join two trees where every range in l is below every
+ *     range in r
+ */
+static range_t *merge_ranges(range_t *l, range_t *r)
+{
+    if (l == NULL)
+	return r;
+    if (r == NULL)
+	return l;
+    if (l->prio > r->prio) {
+	l->right = merge_ranges(l->right, r);
+	return l;
+    }
+    r->left = merge_ranges(l, r->left);
+    return r;
 }
 
 
@@ -469,7 +905,8 @@ static void clear_ranges(range_t **ranges)
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * read_trace - read a trace file and store it in memory. Binary traces
+ *     (see trace.h) are recognized by their magic and mapped by map_trace.
  */
 static trace_t *read_trace(char *tracedir, char *filename)
 {
@@ -495,6 +932,16 @@ static trace_t *read_trace(char *tracedir, char *filename)
 	sprintf(msg, "Could not open %s in read_trace", path);
 	unix_error(msg);
     }
+    trace->map = NULL;
+    trace->map_size = 0;
+    if (fread(type, 1, TRACE_MAGIC_LEN, tracefile) == TRACE_MAGIC_LEN &&
+	memcmp(type, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+	fclose(tracefile);
+	map_trace(trace, path);
+	return trace;
+    }
+    rewind(tracefile);
+
     fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
     fscanf(tracefile, "%d", &(trace->num_ids));     
     fscanf(tracefile, "%d", &(trace->num_ops));     
@@ -554,13 +1001,67 @@ static trace_t *read_trace(char *tracedir, char *filename)
     return trace;
 }
 
+/*
+ * map_trace - map the binary trace file at path read-only and use the
+ *     requests in place. Only the blocks arrays are allocated, so loading
+ *     costs no per-request work besides one pass checking the requests.
+ */
+static void map_trace(trace_t *trace, char *path)
+{
+    int fd, i;
+    struct stat st;
+    trace_hdr_t *hdr;
+    traceop_t *op;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, &st) < 0) {
+	sprintf(msg, "Could not open %s in map_trace", path);
+	unix_error(msg);
+    }
+    if ((size_t)st.st_size < sizeof(trace_hdr_t))
+	app_error("Binary trace is shorter than its header");
+    trace->map_size = st.st_size;
+    trace->map = mmap(NULL, trace->map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (trace->map == MAP_FAILED)
+	unix_error("mmap failed in map_trace");
+    close(fd);
+
+    hdr = (trace_hdr_t *)trace->map;
+    trace->sugg_heapsize = hdr->sugg_heapsize; /* not used */
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;               /* not used */
+    trace->ops = (traceop_t *)(hdr + 1);
+    if (trace->num_ids < 0 || trace->num_ops < 0 ||
+	trace->map_size != sizeof(trace_hdr_t) + 
+	(size_t)trace->num_ops * sizeof(traceop_t))
+	app_error("Binary trace size does not match its header");
+
+    /* The replay loops index blocks[] without checks, so check here */
+    for (i = 0, op = trace->ops; i < trace->num_ops; i++, op++)
+	if ((unsigned)op->type > REALLOC ||
+	    (unsigned)op->index >= (unsigned)trace->num_ids) {
+	    sprintf(msg, "Bogus request %d in binary trace %s", i, path);
+	    app_error(msg);
+	}
+
+    if ((trace->blocks = 
+	 (char **)malloc(trace->num_ids * sizeof(char *))) == NULL ||
+	(trace->block_sizes = 
+	 (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+	unix_error("malloc failed in map_trace");
+}
+
 /*
  * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ *              to, all of which were allocated in read_trace(), or
+ *              unmap the file that holds the requests of a binary trace.
  */
 void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
+    if (trace->map != NULL)   /* free the three arrays... */
+	munmap(trace->map, trace->map_size);
+    else
+	free(trace->ops);
     free(trace->blocks);      
     free(trace->block_sizes);
     free(trace);              /* and the trace record itself... */
@@ -584,7 +1085,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
     char *oldp;
     char *p;
     
-    /* Reset the heap and free any records in the range list */
+    /* Reset the heap and return the records of the range tree */
     mem_reset_brk();
     clear_ranges(ranges);
 
@@ -611,7 +1112,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    
 	    /* 
 	     * Test the range of the new block for correctness and add it 
-	     * to the range list if OK. The block must be  be aligned properly,
+	     * to the range tree if OK. The block must be  be aligned properly,
 	     * and must not overlap any currently allocated block. 
 	     */ 
 	    if (add_range(ranges, p, size, tracenum, i) == 0)
@@ -638,10 +1139,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 		return 0;
 	    }
 	    
-	    /* Remove the old region from the range list */
+	    /* Remove the old region from the range tree */
 	    remove_range(ranges, oldp);
 	    
-	    /* Check new block for correctness and add it to range list */
+	    /* Check new block for correctness and add it to range tree */
 	    if (add_range(ranges, newp, size, tracenum, i) == 0)
 		return 0;
 	    
@@ -653,7 +1154,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
 	    oldsize = trace->block_sizes[index];
 	    if (size < oldsize) oldsize = size;
 	    for (j = 0; j < oldsize; j++) {
-	      if (newp[j] != (index & 0xFF)) {
+	      if ((unsigned char)newp[j] != (index & 0xFF)) {
 		malloc_error(tracenum, i, "mm_realloc did not preserve the "
 			     "data from old block");
 		return 0;
@@ -690,9 +1191,10 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges)
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the 
  *   size of the heap in bytes after running the student's malloc 
- *   package on the trace. Note that our implementation of mem_sbrk() 
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap. 
+ *   package on the trace. Since mem_sbrk() lets the students decrement
+ *   the brk pointer, heapsize is the high water mark of the heap plus
+ *   the regions from mem_map(), as reported by mem_peak_footprint(),
+ *   not the final brk.
  *   
  */
 static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
@@ -774,7 +1276,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges)
         }
     }
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_footprint());
 }
 
 
@@ -825,6 +1327,416 @@ static void eval_mm_speed(void *ptr)
         }
 }
 
+/*
+ * eval_mm_latency - Replay the trace once like eval_mm_speed, but read
+ *     the tick counter around every request and record the difference
+ *     in lat[type], the histogram of its request type.
+ */
+static void eval_mm_latency(trace_t *trace, hist_t *lat)
+{
+    int i, index, size;
+    char *p;
+    uint64_t start, end;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) 
+	app_error("mm_init failed in eval_mm_latency");
+
+    /* Interpret each trace request */
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    start = hist_ticks();
+	    p = mm_malloc(size);
+	    end = hist_ticks();
+            if (p == NULL)
+		app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+	case REALLOC: /* mm_realloc */
+	    start = hist_ticks();
+	    p = mm_realloc(trace->blocks[index], size);
+	    end = hist_ticks();
+            if (p == NULL)
+		app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+	    start = hist_ticks();
+            mm_free(trace->blocks[index]);
+	    end = hist_ticks();
+            break;
+
+	default:
+	    app_error("Nonexistent request type in eval_mm_latency");
+	    return;
+        }
+	hist_add(&lat[trace->ops[i].type], end - start);
+    }
+}
+
+/*
+ * eval_mm_stream - Evaluate the mm package on a trace read with a
+ *     stream (see stream.h) instead of read_trace, so the driver's memory
+ *     depends only on the live blocks, not on the length of the trace.
+ *     A checked pass measures correctness and utilization together, and
+ *     if it succeeds a second, unchecked pass measures the time. Each
+ *     pass reads the file once, so there is no K-best repetition.
+ */
+static void eval_mm_stream(char *tracedir, char *filename, int tracenum,
+			   range_t **ranges, stats_t *stats)
+{
+    char path[MAXLINE];
+
+    if (verbose > 1)
+	printf("Streaming tracefile: %s\n", filename);
+    strcpy(path, tracedir);
+    strcat(path, filename);
+
+    if (verbose > 1)
+	printf("Checking mm_malloc for correctness, efficiency, ");
+    stats->valid = stream_mm_pass(path, tracenum, ranges, 1, stats);
+    clear_ranges(ranges);
+    if (stats->valid) {
+	if (verbose > 1)
+	    printf("and performance.\n");
+	stream_mm_pass(path, tracenum, ranges, 0, stats);
+    }
+}
+
+/*
+ * stream_mm_pass - Replay the trace at path once. With check set, do
+ *     the checks of eval_mm_valid, and fill in stats->ops and stats->util
+ *     like eval_mm_util. Otherwise only fill in stats->secs, the time of
+ *     the whole replay including waits for the prefetch thread.
+ */
+static int stream_mm_pass(char *path, int tracenum, range_t **ranges,
+			  int check, stats_t *stats)
+{
+    stream_t *s;
+    livemap_t live;
+    live_t *e;
+    traceop_t *ops;
+    int i, j, n;
+    int index, size, oldsize;
+    long opnum = 0;
+    double total_size = 0, max_total_size = 0;
+    char *p, *newp;
+    struct timeval start, end;
+    int valid = 0;
+
+    if ((s = stream_open(path)) == NULL) {
+	sprintf(msg, "Could not open %s in stream_mm_pass", path);
+	unix_error(msg);
+    }
+    livemap_init(&live);
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0) {
+	malloc_error(tracenum, 0, "mm_init failed.");
+	goto done;
+    }
+    gettimeofday(&start, NULL);
+
+    while ((n = stream_next(s, &ops)) > 0) {
+	for (i = 0; i < n; i++, opnum++) {
+	    index = ops[i].index;
+	    size = ops[i].size;
+
+	    switch (ops[i].type) {
+
+	    case ALLOC: /* mm_malloc */
+		if ((p = mm_malloc(size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_malloc failed.");
+		    goto done;
+		}
+		if (check) {
+		    if (add_range(ranges, p, size, tracenum, opnum) == 0)
+			goto done;
+		    memset(p, index & 0xFF, size);
+		    total_size += size;
+		    if (total_size > max_total_size)
+			max_total_size = total_size;
+		}
+		/* Like the blocks array, a reused id forgets the old block */
+		if ((e = livemap_find(&live, index)) == NULL)
+		    e = livemap_insert(&live, index);
+		e->p = p;
+		e->size = size;
+		break;
+
+	    case REALLOC: /* mm_realloc */
+		if ((e = livemap_find(&live, index)) == NULL)
+		    goto bad_id;
+		if (check)
+		    remove_range(ranges, e->p);
+		if ((newp = mm_realloc(e->p, size)) == NULL) {
+		    malloc_error(tracenum, opnum, "mm_realloc failed.");
+		    goto done;
+		}
+		if (check) {
+		    if (add_range(ranges, newp, size, tracenum, opnum) == 0)
+			goto done;
+		    oldsize = e->size;
+		    if (size < oldsize) oldsize = size;
+		    for (j = 0; j < oldsize; j++) {
+			if ((unsigned char)newp[j] != (index & 0xFF)) {
+			    malloc_error(tracenum, opnum, "mm_realloc did not "
+					 "preserve the data from old block");
+			    goto done;
+			}
+		    }
+		    memset(newp, index & 0xFF, size);
+		    total_size += size - e->size;
+		    if (total_size > max_total_size)
+			max_total_size = total_size;
+		}
+		e->p = newp;
+		e->size = size;
+		break;
+
+	    case FREE: /* mm_free */
+		if ((e = livemap_find(&live, index)) == NULL)
+		    goto bad_id;
+		if (check) {
+		    remove_range(ranges, e->p);
+		    total_size -= e->size;
+		}
+		mm_free(e->p);
+		livemap_remove(&live, e);
+		break;
+
+	    default:
+		app_error("Nonexistent request type in stream_mm_pass");
+	    }
+	}
+    }
+    if (n < 0) {
+	sprintf(msg, "Bogus request after line %ld in %s", 
+		LINENUM(opnum), path);
+	app_error(msg);
+    }
+
+    gettimeofday(&end, NULL);
+    if (check) {
+	stats->ops = opnum;
+	stats->util = max_total_size / (double)mem_peak_footprint();
+	stats->heapsize = mem_peak_footprint();
+    }
+    else
+	stats->secs = (end.tv_sec - start.tv_sec) + 
+	    (end.tv_usec - start.tv_usec) / 1e6;
+    valid = 1;
+
+ done:
+    livemap_free(&live);
+    stream_close(s);
+    return valid;
+
+ bad_id:
+    sprintf(msg, "Request on line %ld of %s uses id %d, which isn't "
+	    "allocated", LINENUM(opnum), path, index);
+    app_error(msg);
+    return 0;
+}
+
+#ifdef MM_THREADS
+/*
+ * eval_mm_threads - Replay nthreads copies of a trace concurrently,
+ *     each on its own thread. If check is set, every request is checked
+ *     like in eval_mm_valid against a range tree shared by all threads,
+ *     and we return whether all of them were correct. Otherwise the
+ *     replay is run JOB_REPS times and the fastest run goes to stats.
+ */
+static int eval_mm_threads(trace_t *trace, int tracenum, int nthreads,
+			   int check, job_stats_t *stats)
+{
+    replay_t *replays;
+    pthread_t *tids;
+    int i, rep, valid = 1;
+    double start, end, thr_kops;
+
+    if ((replays = (replay_t *)calloc(nthreads, sizeof(replay_t))) == NULL ||
+	(tids = (pthread_t *)malloc(nthreads * sizeof(pthread_t))) == NULL)
+	unix_error("calloc failed in eval_mm_threads");
+    for (i = 0; i < nthreads; i++) {
+	replays[i].trace = trace;
+	replays[i].tracenum = tracenum;
+	replays[i].thread = i;
+	replays[i].check = check;
+	replays[i].blocks = (char **)malloc(trace->num_ids * sizeof(char *));
+	replays[i].block_sizes = 
+	    (size_t *)malloc(trace->num_ids * sizeof(size_t));
+	if (replays[i].blocks == NULL || replays[i].block_sizes == NULL)
+	    unix_error("malloc failed in eval_mm_threads");
+    }
+    if (stats != NULL) {
+	stats->ops = (double)nthreads * trace->num_ops;
+	stats->secs = DBL_MAX;
+    }
+
+    for (rep = 0; rep < (check ? 1 : JOB_REPS); rep++) {
+	/* Reset the heap and initialize the mm package */
+	mem_reset_brk();
+	clear_ranges(&job_ranges);
+	if (mm_init() < 0) {
+	    malloc_error(tracenum, 0, "mm_init failed.");
+	    valid = 0;
+	    break;
+	}
+
+	/* Start all threads at once, then wait for all of them */
+	pthread_barrier_init(&job_barrier, NULL, nthreads);
+	for (i = 0; i < nthreads; i++)
+	    if (pthread_create(&tids[i], NULL, replay_thread, &replays[i]))
+		unix_error("pthread_create failed in eval_mm_threads");
+	for (i = 0; i < nthreads; i++)
+	    pthread_join(tids[i], NULL);
+	pthread_barrier_destroy(&job_barrier);
+
+	start = DBL_MAX;
+	end = 0;
+	thr_kops = 0;
+	for (i = 0; i < nthreads; i++) {
+	    valid &= replays[i].valid;
+	    start = (replays[i].start < start) ? replays[i].start : start;
+	    end = (replays[i].end > end) ? replays[i].end : end;
+	    thr_kops += (trace->num_ops/1e3) / 
+		(replays[i].end - replays[i].start);
+	}
+	if (!valid)
+	    break;
+	if (stats != NULL && end - start < stats->secs) {
+	    stats->secs = end - start;
+	    stats->thr_kops = thr_kops / nthreads;
+	}
+    }
+
+    clear_ranges(&job_ranges);
+    for (i = 0; i < nthreads; i++) {
+	free(replays[i].blocks);
+	free(replays[i].block_sizes);
+    }
+    free(replays);
+    free(tids);
+    return valid;
+}
+
+/*
+ * replay_thread - Thread routine of eval_mm_threads. Replays the trace
+ *     once in its own id space, checking each request if asked to.
+ *     Changes to the shared range tree (and error reports) are made
+ *     under job_lock. A block's range is removed before the block is
+ *     handed back to mm_free or mm_realloc, so another thread can never
+ *     get an overlapping block while its old range is still listed.
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *r = (replay_t *)ptr;
+    trace_t *trace = r->trace;
+    int i, j, ok;
+    int index, size, oldsize;
+    int id;       /* global id, also the fill byte of the block */
+    char *p, *newp, *oldp;
+    struct timeval tv;
+
+    r->valid = 0;
+    pthread_barrier_wait(&job_barrier);
+    gettimeofday(&tv, NULL);
+    r->start = tv.tv_sec + tv.tv_usec / 1e6;
+
+    for (i = 0;  i < trace->num_ops;  i++) {
+	index = trace->ops[i].index;
+	size = trace->ops[i].size;
+	id = r->thread * trace->num_ids + index;
+
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+	    if ((p = mm_malloc(size)) == NULL) {
+		pthread_mutex_lock(&job_lock);
+		malloc_error(r->tracenum, i, "mm_malloc failed.");
+		pthread_mutex_unlock(&job_lock);
+		return NULL;
+	    }
+	    if (r->check) {
+		pthread_mutex_lock(&job_lock);
+		ok = add_range(&job_ranges, p, size, r->tracenum, i);
+		pthread_mutex_unlock(&job_lock);
+		if (!ok)
+		    return NULL;
+		memset(p, id & 0xFF, size);
+	    }
+	    r->blocks[index] = p;
+	    r->block_sizes[index] = size;
+	    break;
+
+        case REALLOC: /* mm_realloc */
+	    oldp = r->blocks[index];
+	    if (r->check) {
+		pthread_mutex_lock(&job_lock);
+		remove_range(&job_ranges, oldp);
+		pthread_mutex_unlock(&job_lock);
+	    }
+	    if ((newp = mm_realloc(oldp, size)) == NULL) {
+		pthread_mutex_lock(&job_lock);
+		malloc_error(r->tracenum, i, "mm_realloc failed.");
+		pthread_mutex_unlock(&job_lock);
+		return NULL;
+	    }
+	    if (r->check) {
+		pthread_mutex_lock(&job_lock);
+		ok = add_range(&job_ranges, newp, size, r->tracenum, i);
+		pthread_mutex_unlock(&job_lock);
+		if (!ok)
+		    return NULL;
+
+		oldsize = r->block_sizes[index];
+		if (size < oldsize) oldsize = size;
+		for (j = 0; j < oldsize; j++) {
+		    if (newp[j] != (char)(id & 0xFF)) {
+			pthread_mutex_lock(&job_lock);
+			malloc_error(r->tracenum, i, "mm_realloc did not "
+				     "preserve the data from old block");
+			pthread_mutex_unlock(&job_lock);
+			return NULL;
+		    }
+		}
+		memset(newp, id & 0xFF, size);
+	    }
+	    r->blocks[index] = newp;
+	    r->block_sizes[index] = size;
+	    break;
+
+        case FREE: /* mm_free */
+	    p = r->blocks[index];
+	    if (r->check) {
+		pthread_mutex_lock(&job_lock);
+		remove_range(&job_ranges, p);
+		pthread_mutex_unlock(&job_lock);
+	    }
+	    mm_free(p);
+	    break;
+
+	default:
+	    app_error("Nonexistent request type in replay_thread");
+        }
+    }
+
+    gettimeofday(&tv, NULL);
+    r->end = tv.tv_sec + tv.tv_usec / 1e6;
+    r->valid = 1;
+    return NULL;
+}
+#endif
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -915,8 +1827,424 @@ static void eval_libc_speed(void *ptr)
  ************************************/
 
 
+#ifdef MM_AB
+/*
+ * eval_mm_ab - Check the trace with both packages and record their
+ *     utilization, then time reps rounds of one run of each. A coin
+ *     flip decides which package goes first in each round, so slow
+ *     drifts (frequency scaling, other load) hit both alike.
+ */
+static void eval_mm_ab(trace_t *trace, int tracenum, int reps,
+		       range_t **ranges, ab_stats_t *stats)
+{
+    speed_t speed_params;
+    int k, r, first;
+
+    stats->ops = trace->num_ops;
+    stats->valid = 1;
+    for (k=0; k < 2; k++) {
+	mm_cur = &mm_impls[k];
+	if (verbose > 1)
+	    printf("Checking %s for correctness, ", mm_cur->name);
+	if (!eval_mm_valid(trace, tracenum, ranges)) {
+	    stats->valid = 0;
+	    return;
+	}
+	if (verbose > 1)
+	    printf("efficiency.\n");
+	stats->util[k] = eval_mm_util(trace, tracenum, ranges);
+	if ((stats->secs[k] = (double *)malloc(reps * sizeof(double))) == NULL)
+	    unix_error("malloc failed in eval_mm_ab");
+    }
+
+    if (verbose > 1)
+	printf("Timing %d interleaved runs.\n", reps);
+    speed_params.trace = trace;
+    speed_params.ranges = *ranges;
+    for (k=0; k < 2; k++) { /* warm up both */
+	mm_cur = &mm_impls[k];
+	eval_mm_speed(&speed_params);
+    }
+    for (r=0; r < reps; r++) {
+	first = ab_rand() & 1;
+	for (k=0; k < 2; k++) {
+	    mm_cur = &mm_impls[first ^ k];
+	    stats->secs[first ^ k][r] = fclock_run(eval_mm_speed, &speed_params);
+	}
+    }
+}
+
 /*
- * printresults - prints a performance summary for some malloc package
+ * print_ab_results - prints the -b comparison. Speedup is A's secs over
+ *     B's, so above 1 means B is faster. Its 95% confidence interval is
+ *     a percentile bootstrap over the rounds of each trace; the total
+ *     resamples the rounds of every trace. Utilization doesn't vary
+ *     between runs, so per trace only its change is shown, and the
+ *     total's interval resamples the traces. A difference counts when
+ *     its interval excludes no change.
+ */
+static void print_ab_results(int n, int reps, ab_stats_t *stats)
+{
+    double *boot, lo, hi, sum[2], tsum[2], du, dusum;
+    int i, b, k, r, nvalid = 0, *valid;
+
+    if ((boot = (double *)malloc(AB_RESAMPLES * sizeof(double))) == NULL ||
+	(valid = (int *)malloc(n * sizeof(int))) == NULL)
+	unix_error("malloc failed in print_ab_results");
+
+    printf("%5s%7s%7s%7s%8s%8s%8s%17s  %s\n", "trace", "utilA", "utilB",
+	   "dutil", "KopsA", "KopsB", "speedup", "95% CI", "verdict");
+    tsum[0] = tsum[1] = du = 0;
+    for (i=0; i < n; i++) {
+	if (!stats[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	valid[nvalid++] = i;
+	du += stats[i].util[1] - stats[i].util[0];
+	for (k=0; k < 2; k++) {
+	    sum[k] = 0;
+	    for (r=0; r < reps; r++)
+		sum[k] += stats[i].secs[k][r];
+	    tsum[k] += sum[k];
+	}
+	for (b=0; b < AB_RESAMPLES; b++) {
+	    double rs[2] = {0, 0};
+
+	    for (r=0; r < reps; r++) {
+		int pick = ab_rand() % reps;
+
+		rs[0] += stats[i].secs[0][pick];
+		rs[1] += stats[i].secs[1][pick];
+	    }
+	    boot[b] = rs[0] / rs[1];
+	}
+	ab_ci(boot, &lo, &hi);
+	printf("%2d   %6.1f%%%6.1f%%%+6.1f%%%8.0f%8.0f%7.3fx  [%6.3f,%6.3f]  %s\n",
+	       i, stats[i].util[0]*100.0, stats[i].util[1]*100.0,
+	       (stats[i].util[1] - stats[i].util[0])*100.0,
+	       (stats[i].ops/1e3) / (sum[0]/reps),
+	       (stats[i].ops/1e3) / (sum[1]/reps),
+	       sum[0] / sum[1], lo, hi,
+	       lo > 1 ? "B faster" : hi < 1 ? "B slower" : "no difference");
+    }
+    if (nvalid == 0) {
+	free(boot);
+	free(valid);
+	return;
+    }
+
+    /* Total throughput, resampling the rounds of every trace */
+    for (b=0; b < AB_RESAMPLES; b++) {
+	double rs[2] = {0, 0};
+
+	for (i=0; i < nvalid; i++)
+	    for (r=0; r < reps; r++) {
+		int pick = ab_rand() % reps;
+
+		rs[0] += stats[valid[i]].secs[0][pick];
+		rs[1] += stats[valid[i]].secs[1][pick];
+	    }
+	boot[b] = rs[0] / rs[1];
+    }
+    ab_ci(boot, &lo, &hi);
+    printf("%-5s%44.3fx  [%6.3f,%6.3f]  throughput: %s\n", "Total",
+	   tsum[0] / tsum[1], lo, hi,
+	   lo > 1 ? "B faster" : hi < 1 ? "B slower" : "no difference");
+
+    /* Average utilization, resampling the traces */
+    for (b=0; b < AB_RESAMPLES; b++) {
+	dusum = 0;
+	for (i=0; i < nvalid; i++) {
+	    ab_stats_t *s = &stats[valid[ab_rand() % nvalid]];
+
+	    dusum += s->util[1] - s->util[0];
+	}
+	boot[b] = dusum / nvalid * 100.0;
+    }
+    ab_ci(boot, &lo, &hi);
+    printf("%-5s%+20.1f%%%26s[%+6.1f,%+6.1f]  util: %s\n", "", 
+	   du / nvalid * 100.0, "", lo, hi,
+	   lo > 0 ? "B better" : hi < 0 ? "B worse" : "no difference");
+    free(boot);
+    free(valid);
+}
+
+/*
+ * ab_rand - xorshift generator for the -b run order and resampling.
+ *     Seeded with a constant so the bootstrap is reproducible.
+ */
+static unsigned ab_rand(void)
+{
+    static unsigned state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/* Compare doubles for qsort */
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+/*
+ * ab_ci - the 2.5th and 97.5th percentiles of AB_RESAMPLES bootstrap
+ *     samples, which it sorts
+ */
+static void ab_ci(double *samples, double *lo, double *hi)
+{
+    qsort(samples, AB_RESAMPLES, sizeof(double), cmp_double);
+    *lo = samples[(int)(0.025 * AB_RESAMPLES)];
+    *hi = samples[(int)(0.975 * AB_RESAMPLES) - 1];
+}
+#endif
+
+/*
+ * The -o results. Both formats give, for each trace of the mm package,
+ * the stats of printresults plus the heap size and the spread of the
+ * timed runs, the -L percentiles and the -P counts when those were
+ * collected, and how the driver was built and timed. Values that
+ * weren't measured are null in JSON and empty in CSV.
+ */
+#ifdef MM_THREADS
+#define BUILD_THREADS 1
+#else
+#define BUILD_THREADS 0
+#endif
+
+static char *op_names[NUM_OPTYPES] = {"malloc", "free", "realloc"};
+static double lat_pcts[] = {50, 90, 99, 99.9};
+static char *lat_names[] = {"p50", "p90", "p99", "p99.9", "max"};
+
+/* json_string - write str as a JSON string */
+static void json_string(FILE *fp, const char *str)
+{
+    fputc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"' || *str == '\\')
+	    fprintf(fp, "\\%c", *str);
+	else if ((unsigned char)*str < 0x20)
+	    fprintf(fp, "\\u%04x", *str);
+	else
+	    fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+/* csv_string - write str as a CSV field, quoted if it needs to be */
+static void csv_string(FILE *fp, const char *str)
+{
+    if (strpbrk(str, ",\"\n") == NULL) {
+	fputs(str, fp);
+	return;
+    }
+    fputc('"', fp);
+    for (; *str; str++) {
+	if (*str == '"')
+	    fputc('"', fp);
+	fputc(*str, fp);
+    }
+    fputc('"', fp);
+}
+
+/* latency - the ns of value k (see lat_names) of histogram h */
+static double latency(hist_t *h, int k)
+{
+    uint64_t ticks = (k < 4) ? hist_percentile(h, lat_pcts[k]) : h->max;
+
+    return ticks / hist_ticks_per_ns();
+}
+
+/*
+ * write_json - write the results as one JSON object
+ */
+static void write_json(FILE *fp, int n, char **tracefiles, stats_t *stats,
+		       hist_t *lat, perfctr_vals_t *ctrs, double perfindex)
+{
+    double mhz, ops = 0, secs = 0, util = 0;
+    char *method = fsecs_method(&mhz);
+    int i, k, t, numcorrect = 0;
+
+    fprintf(fp, "{\n  \"build\": {\"revision\": ");
+    json_string(fp, build_rev);
+    fprintf(fp, ", \"compiler\": ");
+    json_string(fp, __VERSION__);
+    fprintf(fp, ", \"date\": ");
+    json_string(fp, build_date);
+    fprintf(fp, ", \"threads\": %s},\n", BUILD_THREADS ? "true" : "false");
+    fprintf(fp, "  \"timing\": {\"method\": ");
+    json_string(fp, method);
+    if (mhz > 0)
+	fprintf(fp, ", \"mhz\": %.1f},\n", mhz);
+    else
+	fprintf(fp, ", \"mhz\": null},\n");
+
+    fprintf(fp, "  \"traces\": [");
+    for (i=0; i < n; i++) {
+	fprintf(fp, "%s\n    {\"trace\": %d, \"file\": ", i ? "," : "", i);
+	json_string(fp, tracefiles[i]);
+	if (!stats[i].valid) {
+	    fprintf(fp, ", \"valid\": false}");
+	    continue;
+	}
+	numcorrect++;
+	ops += stats[i].ops;
+	secs += stats[i].secs;
+	util += stats[i].util;
+	fprintf(fp, ", \"valid\": true, \"ops\": %.0f, \"secs\": %.9g, "
+		"\"kops\": %.6g, \"util\": %.6g, \"heap_bytes\": %lu",
+		stats[i].ops, stats[i].secs, (stats[i].ops/1e3)/stats[i].secs,
+		stats[i].util, (unsigned long)stats[i].heapsize);
+	if (stats[i].reps)
+	    fprintf(fp, ", \"reps\": %d, \"sd\": %.9g, \"ci95\": %.9g",
+		    stats[i].reps, stats[i].sd, stats[i].ci);
+	else
+	    fprintf(fp, ", \"reps\": null, \"sd\": null, \"ci95\": null");
+
+	if (lat) {
+	    fprintf(fp, ",\n     \"latency_ns\": {");
+	    for (t=0; t < NUM_OPTYPES; t++) {
+		hist_t *h = &lat[i*NUM_OPTYPES + t];
+
+		fprintf(fp, "%s\"%s\": {\"count\": %llu", t ? ", " : "",
+			op_names[t], (unsigned long long)h->count);
+		for (k=0; k < 5; k++)
+		    if (h->count)
+			fprintf(fp, ", \"%s\": %.1f", lat_names[k],
+				latency(h, k));
+		    else
+			fprintf(fp, ", \"%s\": null", lat_names[k]);
+		fprintf(fp, "}");
+	    }
+	    fprintf(fp, "}");
+	}
+	if (ctrs) {
+	    fprintf(fp, ",\n     \"counters\": {");
+	    for (k=0; k < PERFCTR_NUM; k++) {
+		fprintf(fp, "%s\"%s\": ", k ? ", " : "", perfctr_names[k]);
+		if (ctrs[i].valid[k])
+		    fprintf(fp, "%.0f", ctrs[i].count[k]);
+		else
+		    fprintf(fp, "null");
+	    }
+	    fprintf(fp, "}");
+	}
+	fprintf(fp, "}");
+    }
+    fprintf(fp, "\n  ],\n");
+
+    fprintf(fp, "  \"total\": {\"correct\": %d, \"errors\": %d, "
+	    "\"ops\": %.0f, \"secs\": %.9g, \"kops\": ",
+	    numcorrect, errors, ops, secs);
+    if (secs > 0)
+	fprintf(fp, "%.6g", (ops/1e3)/secs);
+    else
+	fprintf(fp, "null");
+    fprintf(fp, ", \"util\": %.6g, \"perfidx\": %.1f}\n}\n",
+	    util/n, perfindex);
+}
+
+/*
+ * write_csv - write the results as a header line and one line per
+ *     trace. The build and timing fields repeat on every line, so each
+ *     line stands on its own.
+ */
+static void write_csv(FILE *fp, int n, char **tracefiles, stats_t *stats,
+		      hist_t *lat, perfctr_vals_t *ctrs)
+{
+    double mhz;
+    char *method = fsecs_method(&mhz);
+    int i, k, t;
+
+    fprintf(fp, "revision,compiler,date,threads,timing,mhz,trace,file,valid,"
+	    "ops,secs,kops,util,heap_bytes,reps,sd,ci95");
+    if (lat)
+	for (t=0; t < NUM_OPTYPES; t++) {
+	    fprintf(fp, ",%s_count", op_names[t]);
+	    for (k=0; k < 5; k++)
+		fprintf(fp, ",%s_%s_ns", op_names[t], lat_names[k]);
+	}
+    if (ctrs)
+	for (k=0; k < PERFCTR_NUM; k++)
+	    fprintf(fp, ",%s", perfctr_names[k]);
+    fprintf(fp, "\n");
+
+    for (i=0; i < n; i++) {
+	csv_string(fp, build_rev);
+	fputc(',', fp);
+	csv_string(fp, __VERSION__);
+	fputc(',', fp);
+	csv_string(fp, build_date);
+	fprintf(fp, ",%d,%s,", BUILD_THREADS, method);
+	if (mhz > 0)
+	    fprintf(fp, "%.1f", mhz);
+	fprintf(fp, ",%d,", i);
+	csv_string(fp, tracefiles[i]);
+	if (!stats[i].valid) {
+	    fprintf(fp, ",0,,,,,,,,");
+	    if (lat)
+		for (k=0; k < NUM_OPTYPES * 6; k++)
+		    fputc(',', fp);
+	    if (ctrs)
+		for (k=0; k < PERFCTR_NUM; k++)
+		    fputc(',', fp);
+	    fprintf(fp, "\n");
+	    continue;
+	}
+	fprintf(fp, ",1,%.0f,%.9g,%.6g,%.6g,%lu,", stats[i].ops,
+		stats[i].secs, (stats[i].ops/1e3)/stats[i].secs,
+		stats[i].util, (unsigned long)stats[i].heapsize);
+	if (stats[i].reps)
+	    fprintf(fp, "%d,%.9g,%.9g", stats[i].reps, stats[i].sd,
+		    stats[i].ci);
+	else
+	    fprintf(fp, ",,");
+	if (lat)
+	    for (t=0; t < NUM_OPTYPES; t++) {
+		hist_t *h = &lat[i*NUM_OPTYPES + t];
+
+		fprintf(fp, ",%llu", (unsigned long long)h->count);
+		for (k=0; k < 5; k++) {
+		    fputc(',', fp);
+		    if (h->count)
+			fprintf(fp, "%.1f", latency(h, k));
+		}
+	    }
+	if (ctrs)
+	    for (k=0; k < PERFCTR_NUM; k++) {
+		fputc(',', fp);
+		if (ctrs[i].valid[k])
+		    fprintf(fp, "%.0f", ctrs[i].count[k]);
+	    }
+	fprintf(fp, "\n");
+    }
+}
+
+/*
+ * get_spread - copy the spread of the runs behind the last fsecs result
+ *     into stats, if the timing method measures it
+ */
+static void get_spread(stats_t *stats)
+{
+    fclock_stats_t fs;
+
+    if (fsecs_stats(&fs)) {
+	stats->reps = fs.reps;
+	stats->sd = fs.sd;
+	stats->ci = fs.ci;
+    }
+}
+
+/*
+ * printresults - prints a performance summary for some malloc package.
+ *     If the timing method measured the spread of the runs, also prints
+ *     the number of runs, and their standard deviation and the 95%
+ *     confidence interval of secs relative to secs.
  */
 static void printresults(int n, stats_t *stats) 
 {
@@ -924,22 +2252,39 @@ static void printresults(int n, stats_t *stats)
     double secs = 0;
     double ops = 0;
     double util = 0;
+    double var = 0, civar = 0; /* sums of the squared sd and ci */
+    int spread = 1;            /* do all valid traces have a spread? */
+
+    for (i=0; i < n; i++)
+	if (stats[i].valid && stats[i].reps == 0)
+	    spread = 0;
 
     /* Print the individual results for each trace */
-    printf("%5s%7s %5s%8s%10s%6s\n", 
+    printf("%5s%7s %5s%8s%10s%6s", 
 	   "trace", " valid", "util", "ops", "secs", "Kops");
+    if (spread)
+	printf("%6s%7s%7s", "reps", "sd", "+/-");
+    printf("\n");
     for (i=0; i < n; i++) {
 	if (stats[i].valid) {
-	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	    printf("%2d%10s%5.0f%%%8.0f%10.6f%6.0f", 
 		   i,
 		   "yes",
 		   stats[i].util*100.0,
 		   stats[i].ops,
 		   stats[i].secs,
 		   (stats[i].ops/1e3)/stats[i].secs);
+	    if (spread)
+		printf("%6d%6.1f%%%6.1f%%",
+		       stats[i].reps,
+		       stats[i].sd/stats[i].secs*100.0,
+		       stats[i].ci/stats[i].secs*100.0);
+	    printf("\n");
 	    secs += stats[i].secs;
 	    ops += stats[i].ops;
 	    util += stats[i].util;
+	    var += stats[i].sd*stats[i].sd;
+	    civar += stats[i].ci*stats[i].ci;
 	}
 	else {
 	    printf("%2d%10s%6s%8s%10s%6s\n", 
@@ -954,12 +2299,17 @@ static void printresults(int n, stats_t *stats)
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-	printf("%12s%5.0f%%%8.0f%10.6f%6.0f\n", 
+	printf("%12s%5.0f%%%8.0f%10.6f%6.0f", 
 	       "Total       ",
 	       (util/n)*100.0,
 	       ops, 
 	       secs,
 	       (ops/1e3)/secs);
+	/* The traces are timed independently, so their variances add */
+	if (spread)
+	    printf("%6s%6.1f%%%6.1f%%", "", sqrt(var)/secs*100.0,
+		   sqrt(civar)/secs*100.0);
+	printf("\n");
     }
     else {
 	printf("%12s%6s%8s%10s%6s\n", 
@@ -972,6 +2322,163 @@ static void printresults(int n, stats_t *stats)
 
 }
 
+/*
+ * print_latency_results - prints the -L percentiles of every request
+ *     type, for each valid trace and then over all of them
+ */
+static void print_latency_results(int n, stats_t *stats, hist_t *lat)
+{
+    static char *names[NUM_OPTYPES] = {"malloc", "free", "realloc"};
+    static double pcts[] = {50, 90, 99, 99.9};
+    hist_t *total;
+    double rate = hist_ticks_per_ns();
+    int i, t, k;
+
+    if ((total = (hist_t *)malloc(NUM_OPTYPES * sizeof(hist_t))) == NULL)
+	unix_error("malloc failed in print_latency_results");
+    for (t=0; t < NUM_OPTYPES; t++)
+	hist_reset(&total[t]);
+
+    printf("%5s %-8s%9s%8s%8s%8s%8s%10s\n",
+	   "trace", "op", "ops", "p50", "p90", "p99", "p99.9", "max");
+    for (i=0; i <= n; i++) {
+	if (i < n && !stats[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	for (t=0; t < NUM_OPTYPES; t++) {
+	    hist_t *h = (i < n) ? &lat[i*NUM_OPTYPES + t] : &total[t];
+
+	    if (h->count == 0)
+		continue;
+	    if (i < n) {
+		hist_merge(&total[t], h);
+		printf("%2d    ", i);
+	    }
+	    else
+		printf("%-6s", "Total");
+	    printf("%-8s%9llu", names[t], (unsigned long long)h->count);
+	    for (k=0; k < 4; k++)
+		printf("%8.0f", hist_percentile(h, pcts[k]) / rate);
+	    printf("%10.0f\n", h->max / rate);
+	}
+    }
+    free(total);
+}
+
+/*
+ * print_ctr_results - prints the -P counts of every valid trace and of
+ *     all of them together, divided by the number of requests. Events
+ *     that could not be counted are shown as "-".
+ */
+static void print_ctr_results(int n, stats_t *stats, perfctr_vals_t *ctrs)
+{
+    perfctr_vals_t total;
+    double ops = 0, secs = 0;
+    int i, k;
+
+    memset(&total, 0, sizeof(total));
+    for (k=0; k < PERFCTR_NUM; k++)
+	total.valid[k] = 1;
+
+    printf("%5s%8s%6s", "trace", "Kops", "IPC");
+    for (k=0; k < PERFCTR_NUM; k++)
+	printf("%10s", perfctr_names[k]);
+    printf("\n");
+    for (i=0; i <= n; i++) {
+	perfctr_vals_t *v = (i < n) ? &ctrs[i] : &total;
+	double vops = (i < n) ? stats[i].ops : ops;
+	double vsecs = (i < n) ? stats[i].secs : secs;
+
+	if (i < n && !stats[i].valid) {
+	    printf("%2d%10s\n", i, "no");
+	    continue;
+	}
+	if (i < n) {
+	    ops += vops;
+	    secs += vsecs;
+	    for (k=0; k < PERFCTR_NUM; k++) {
+		total.valid[k] &= v->valid[k];
+		total.count[k] += v->count[k];
+	    }
+	    printf("%2d   ", i);
+	}
+	else
+	    printf("%-5s", "Total");
+
+	printf("%8.0f", (vops/1e3)/vsecs);
+	if (v->valid[PC_CYCLES] && v->valid[PC_INSTRS] && v->count[PC_CYCLES] > 0)
+	    printf("%6.2f", v->count[PC_INSTRS] / v->count[PC_CYCLES]);
+	else
+	    printf("%6s", "-");
+	for (k=0; k < PERFCTR_NUM; k++) {
+	    if (v->valid[k])
+		printf("%10.2f", v->count[k] / vops);
+	    else
+		printf("%10s", "-");
+	}
+	printf("\n");
+    }
+}
+
+#ifdef MM_THREADS
+/*
+ * print_job_results - prints the -j results: for every trace one row
+ *     per thread count, then the scaling curve over all traces. Speedup
+ *     is the aggregate throughput relative to the run on one thread.
+ */
+static void print_job_results(int n, int jobs, job_stats_t *stats)
+{
+    int i, k;
+    double ops, secs, base;
+    job_stats_t *s;
+
+    printf("%5s%8s%9s%10s%8s%9s%8s\n", 
+	   "trace", "threads", "ops", "secs", "Kops", "Kops/thr", "speedup");
+    for (i=0; i < n; i++) {
+	if (stats[i*jobs].secs == 0) {
+	    printf("%2d%11s%9s%10s%8s%9s%8s\n", 
+		   i, "-", "-", "-", "-", "-", "-");
+	    continue;
+	}
+	base = stats[i*jobs].ops / stats[i*jobs].secs;
+	for (k=1; k <= jobs; k++) {
+	    s = &stats[i*jobs + k-1];
+	    printf("%2d%11d%9.0f%10.6f%8.0f%9.0f%8.2f\n", 
+		   i,
+		   k,
+		   s->ops,
+		   s->secs,
+		   (s->ops/1e3)/s->secs,
+		   s->thr_kops,
+		   (s->ops/s->secs)/base);
+	}
+    }
+
+    /* Scaling curve: all traces that ran, summed per thread count */
+    printf("\n%12s%9s%10s%8s%17s\n", 
+	   "threads     ", "ops", "secs", "Kops", "speedup");
+    base = 0;
+    for (k=1; k <= jobs; k++) {
+	ops = 0;
+	secs = 0;
+	for (i=0; i < n; i++) {
+	    s = &stats[i*jobs + k-1];
+	    if (stats[i*jobs].secs > 0) {
+		ops += s->ops;
+		secs += s->secs;
+	    }
+	}
+	if (secs == 0)
+	    break;
+	if (k == 1)
+	    base = ops/secs;
+	printf("%7d%14.0f%10.6f%8.0f%17.2f\n", 
+	       k, ops, secs, (ops/1e3)/secs, (ops/secs)/base);
+    }
+}
+#endif
+
 /* 
  * app_error - Report an arbitrary application error
  */
@@ -993,10 +2500,18 @@ void unix_error(char *msg)
 /*
  * malloc_error - Report an error returned by the mm_malloc package
  */
-void malloc_error(int tracenum, int opnum, char *msg)
+void malloc_error(int tracenum, long opnum, char *msg)
 {
     errors++;
-    printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
+#ifdef MM_AB
+    if (ab_running) {
+	printf("ERROR [%c = %s, trace %d, line %ld]: %s\n",
+	       mm_cur == &mm_impls[0] ? 'A' : 'B', mm_cur->name,
+	       tracenum, LINENUM(opnum), msg);
+	return;
+    }
+#endif
+    printf("ERROR [trace %d, line %ld]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
 /* 
@@ -1004,13 +2519,20 @@ void malloc_error(int tracenum, int opnum, char *msg)
  */
 static void usage(void) 
 {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvValsLP] [-f <file>] [-t <dir>] [-j <n>] [-b <n>]\n");
+    fprintf(stderr, "               [-o json|csv]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-b <n>     Compare packages A and B over n runs (mdriver-ab).\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on 1..n threads.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Print latency percentiles of each request type.\n");
+    fprintf(stderr, "\t-o <fmt>   Write results to stdout as json or csv.\n");
+    fprintf(stderr, "\t-P         Print hardware counters of the timed runs.\n");
+    fprintf(stderr, "\t-s         Stream the traces instead of loading them.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
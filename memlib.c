@@ -3,6 +3,7 @@
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
  */
+#define _GNU_SOURCE         /* mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +15,94 @@
 #include "memlib.h"
 #include "config.h"
 
+/* 
+ * With USE_MMAP_HEAP, pages are committed in units of this many bytes
+ * so that a run of small mem_sbrk calls costs one mprotect.
+ */
+#define COMMIT_CHUNK (1<<16)
+
+/* a region handed out by mem_map, outside the heap */
+typedef struct map_region {
+    char *lo;                /* first byte of the region */
+    size_t size;             /* region size, a multiple of the page size */
+    struct map_region *next;
+} map_region_t;
+
+/* 
+ * One of the NUM_HEAPS disjoint heaps. Heap i occupies the MAX_HEAP
+ * bytes starting at mem_start + i * MAX_HEAP.
+ */
+typedef struct heap {
+    char *start_brk;         /* points to first byte of heap */
+    char *brk;               /* points to last byte of heap */
+    char *max_addr;          /* largest legal heap address */ 
+    char *peak_brk;          /* highest brk since the last reset */
+#if USE_MMAP_HEAP
+    char *commit_brk;        /* end of the readable/writable pages */
+#endif
+} heap_t;
+
 /* private variables */
-static char *mem_start_brk;  /* points to first byte of heap */
-static char *mem_brk;        /* points to last byte of heap */
-static char *mem_max_addr;   /* largest legal heap address */ 
+static char *mem_start;          /* storage backing all the heaps */
+static heap_t mem_heaps[NUM_HEAPS];
+static size_t mem_heap_bytes;    /* total size of all the heaps */
+static map_region_t *mem_maps;   /* regions from mem_map */
+static size_t mem_map_bytes;     /* total size of those regions */
+static size_t mem_peak_total;    /* highest heap + mapped bytes since reset */
+
+/* 
+ * With MM_THREADS, arenas in different threads grow their heaps and map
+ * regions concurrently, so every call that changes the model state
+ * holds mem_lock. These calls are rare next to malloc and free.
+ */
+#ifdef MM_THREADS
+#include <pthread.h>
+static pthread_mutex_t mem_lock = PTHREAD_MUTEX_INITIALIZER;
+#define MEM_LOCK() pthread_mutex_lock(&mem_lock)
+#define MEM_UNLOCK() pthread_mutex_unlock(&mem_lock)
+#else
+#define MEM_LOCK()
+#define MEM_UNLOCK()
+#endif
+
+static size_t page_round(size_t size);
+static void update_peak(void);
+static void reset_heap(heap_t *h);
 
 /* 
  * mem_init - initialize the memory system model
  */
 void mem_init(void)
 {
+    int i;
+
+#if USE_MMAP_HEAP
+    /* reserve the address space only; mem_sbrk commits pages */
+    mem_start = (char *)mmap(NULL, (size_t)NUM_HEAPS * MAX_HEAP, PROT_NONE,
+			     MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+			     -1, 0);
+    if (mem_start == (char *)MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+#else
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    if ((mem_start = (char *)malloc((size_t)NUM_HEAPS * MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
-    mem_brk = mem_start_brk;                  /* heap is empty initially */
+    for (i = 0; i < NUM_HEAPS; i++) {
+	heap_t *h = &mem_heaps[i];
+
+	h->start_brk = mem_start + (size_t)i * MAX_HEAP;
+	h->max_addr = h->start_brk + MAX_HEAP;  /* max legal heap address */
+#if USE_MMAP_HEAP
+	h->commit_brk = h->start_brk;
+#endif
+	reset_heap(h);                          /* heap is empty initially */
+    }
 }
 
 /* 
@@ -39,41 +110,264 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    mem_reset_brk();       /* unmaps what is left from mem_map */
+#if USE_MMAP_HEAP
+    munmap(mem_start, (size_t)NUM_HEAPS * MAX_HEAP);
+#else
+    free(mem_start);
+#endif
 }
 
 /*
- * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ * mem_reset_brk - reset the simulated brk pointers to make every heap
+ *    empty and unmap every region still left from mem_map
  */
 void mem_reset_brk()
 {
-    mem_brk = mem_start_brk;
+    map_region_t *r, *next;
+    int i;
+
+    MEM_LOCK();
+    for (r = mem_maps; r != NULL; r = next) {
+	next = r->next;
+	munmap(r->lo, r->size);
+	free(r);
+    }
+    mem_maps = NULL;
+    mem_map_bytes = 0;
+    for (i = 0; i < NUM_HEAPS; i++)
+	reset_heap(&mem_heaps[i]);
+    mem_heap_bytes = 0;
+    mem_peak_total = 0;
+    MEM_UNLOCK();
 }
 
 /* 
- * mem_sbrk - simple model of the sbrk function. Extends the heap 
- *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ * mem_sbrk - simple model of the sbrk function. Extends heap 0
+ *    by incr bytes and returns the start address of the new area.
+ *    A negative incr shrinks the heap; the pages it gives back stay
+ *    committed until mem_trim is called.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    return mem_sbrk_at(0, incr);
+}
+
+/* 
+ * mem_sbrk_at - mem_sbrk for heap number heap
+ */
+void *mem_sbrk_at(int heap, int incr) 
+{
+    heap_t *h = &mem_heaps[heap];
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
+    MEM_LOCK();
+    old_brk = h->brk;
+    if ((incr < 0 && h->brk + incr < h->start_brk) ||
+	(incr > 0 && h->brk + incr > h->max_addr)) {
+	MEM_UNLOCK();
 	errno = ENOMEM;
 	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 	return (void *)-1;
     }
-    mem_brk += incr;
+#if USE_MMAP_HEAP
+    if (h->brk + incr > h->commit_brk) {
+	size_t off = (size_t)(h->brk + incr - h->start_brk);
+	char *new_commit;
+
+	off = (off + COMMIT_CHUNK - 1) & ~(size_t)(COMMIT_CHUNK - 1);
+	new_commit = h->start_brk + off;
+	if (new_commit > h->max_addr)
+	    new_commit = h->max_addr;
+	if (mprotect(h->commit_brk, new_commit - h->commit_brk,
+		     PROT_READ | PROT_WRITE) < 0) {
+	    MEM_UNLOCK();
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Cannot commit pages...\n");
+	    return (void *)-1;
+	}
+	h->commit_brk = new_commit;
+    }
+#endif
+    h->brk += incr;
+    if (h->brk > h->peak_brk)
+	h->peak_brk = h->brk;
+    mem_heap_bytes += incr;
+    update_peak();
+    MEM_UNLOCK();
     return (void *)old_brk;
 }
 
+/*
+ * mem_map - map a fresh region of at least size bytes outside the heap
+ *    and return its start address, or (void *)-1 on failure. The
+ *    region is rounded up to whole pages and counts toward
+ *    mem_peak_footprint() until it is unmapped.
+ */
+void *mem_map(size_t size)
+{
+    map_region_t *r;
+    char *lo;
+
+    size = page_round(size);
+    lo = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == (char *)MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    if ((r = (map_region_t *)malloc(sizeof(map_region_t))) == NULL) {
+	fprintf(stderr, "mem_map: malloc error\n");
+	exit(1);
+    }
+    r->lo = lo;
+    r->size = size;
+    MEM_LOCK();
+    r->next = mem_maps;
+    mem_maps = r;
+    mem_map_bytes += size;
+    update_peak();
+    MEM_UNLOCK();
+    return (void *)lo;
+}
+
+/*
+ * mem_unmap - unmap a region returned by mem_map or mem_remap
+ */
+void mem_unmap(void *ptr, size_t size)
+{
+    map_region_t *r, **prevpp = &mem_maps;
+
+    MEM_LOCK();
+    for (r = mem_maps; r != NULL; r = r->next) {
+	if (r->lo == (char *)ptr) {
+	    *prevpp = r->next;
+	    mem_map_bytes -= r->size;
+	    MEM_UNLOCK();
+	    munmap(r->lo, r->size);
+	    free(r);
+	    return;
+	}
+	prevpp = &(r->next);
+    }
+    MEM_UNLOCK();
+    fprintf(stderr, "ERROR: mem_unmap of %p (%lu bytes) not mapped\n",
+	    ptr, (unsigned long)size);
+}
+
+/*
+ * mem_remap - resize a region returned by mem_map. The contents are
+ *    kept; the region may move. Returns the new start address, or
+ *    (void *)-1 and leaves the region alone on failure.
+ */
+void *mem_remap(void *ptr, size_t old_size, size_t new_size)
+{
+    map_region_t *r;
+    char *lo;
+
+    MEM_LOCK();
+    for (r = mem_maps; r != NULL && r->lo != (char *)ptr; r = r->next)
+	;
+    MEM_UNLOCK();
+    if (r == NULL) {
+	fprintf(stderr, "ERROR: mem_remap of %p (%lu bytes) not mapped\n",
+		ptr, (unsigned long)old_size);
+	return (void *)-1;
+    }
+    new_size = page_round(new_size);
+#ifdef MREMAP_MAYMOVE
+    lo = mremap(r->lo, r->size, new_size, MREMAP_MAYMOVE);
+    if (lo == (char *)MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+#else
+    /* no mremap: map a new region and copy */
+    lo = mmap(NULL, new_size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (lo == (char *)MAP_FAILED) {
+	errno = ENOMEM;
+	return (void *)-1;
+    }
+    memcpy(lo, r->lo, r->size < new_size ? r->size : new_size);
+    munmap(r->lo, r->size);
+#endif
+    MEM_LOCK();
+    mem_map_bytes += new_size - r->size;
+    r->lo = lo;
+    r->size = new_size;
+    update_peak();
+    MEM_UNLOCK();
+    return (void *)lo;
+}
+
+/*
+ * mem_is_mapped - returns 1 if [lo, lo + size) lies inside one region
+ *    from mem_map, 0 otherwise
+ */
+int mem_is_mapped(void *lo, size_t size)
+{
+    map_region_t *r;
+    char *p = (char *)lo;
+    int found = 0;
+
+    MEM_LOCK();
+    for (r = mem_maps; r != NULL && !found; r = r->next) {
+	if (p >= r->lo && p + size <= r->lo + r->size)
+	    found = 1;
+    }
+    MEM_UNLOCK();
+    return found;
+}
+
+/*
+ * mem_trim - give the committed pages above the current brk of heap 0
+ *    back to the system. Returns the number of bytes released. The heap
+ *    model that lives in a malloc'ed buffer cannot release anything.
+ */
+size_t mem_trim(void)
+{
+    return mem_trim_at(0);
+}
+
+/*
+ * mem_trim_at - mem_trim for heap number heap
+ */
+size_t mem_trim_at(int heap)
+{
+#if USE_MMAP_HEAP
+    heap_t *h = &mem_heaps[heap];
+    size_t page = mem_pagesize();
+    size_t off, len;
+    char *keep;
+
+    MEM_LOCK();
+    off = (size_t)(h->brk - h->start_brk);
+    keep = h->start_brk + ((off + page - 1) & ~(page - 1));
+    if (keep >= h->commit_brk) {
+	MEM_UNLOCK();
+	return 0;
+    }
+    len = (size_t)(h->commit_brk - keep);
+    if (madvise(keep, len, MADV_DONTNEED) < 0 ||
+	mprotect(keep, len, PROT_NONE) < 0) {
+	MEM_UNLOCK();
+	return 0;
+    }
+    h->commit_brk = keep;
+    MEM_UNLOCK();
+    return len;
+#else
+    return 0;
+#endif
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
 void *mem_heap_lo()
 {
-    return (void *)mem_start_brk;
+    return mem_heap_lo_at(0);
 }
 
 /* 
@@ -81,15 +375,72 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return mem_heap_hi_at(0);
+}
+
+/*
+ * mem_heap_lo_at, mem_heap_hi_at - first and last byte of heap number heap
+ */
+void *mem_heap_lo_at(int heap)
+{
+    return (void *)mem_heaps[heap].start_brk;
+}
+
+void *mem_heap_hi_at(int heap)
+{
+    return (void *)(mem_heaps[heap].brk - 1);
+}
+
+/*
+ * mem_heap_index - returns the number of the heap whose reserved range
+ *    contains p, or -1 if p is in none of them
+ */
+int mem_heap_index(void *p)
+{
+    size_t off = (size_t)((char *)p - mem_start);
+
+    if ((char *)p < mem_start || off >= (size_t)NUM_HEAPS * MAX_HEAP)
+	return -1;
+    return (int)(off / MAX_HEAP);
+}
+
+/*
+ * mem_is_heap - returns 1 if [lo, lo + size) lies inside the used part
+ *    of one heap, 0 otherwise
+ */
+int mem_is_heap(void *lo, size_t size)
+{
+    int i = mem_heap_index(lo);
+    char *p = (char *)lo;
+
+    return i >= 0 && p + size <= mem_heaps[i].brk;
 }
 
 /*
- * mem_heapsize() - returns the heap size in bytes
+ * mem_heapsize() - returns the size of heap 0 in bytes
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem_heaps[0].brk - mem_heaps[0].start_brk);
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest size of heap 0 in bytes
+ *    since the last mem_reset_brk. Unlike mem_heapsize, it does not go
+ *    down when the heap shrinks.
+ */
+size_t mem_peak_heapsize() 
+{
+    return (size_t)(mem_heaps[0].peak_brk - mem_heaps[0].start_brk);
+}
+
+/*
+ * mem_peak_footprint() - returns the largest sum of all heap sizes and
+ *    the mem_map region sizes in bytes since the last mem_reset_brk
+ */
+size_t mem_peak_footprint() 
+{
+    return mem_peak_total;
 }
 
 /*
@@ -99,3 +450,33 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * page_round - round size up to a multiple of the page size
+ */
+static size_t page_round(size_t size)
+{
+    size_t page = mem_pagesize();
+
+    return (size + page - 1) & ~(page - 1);
+}
+
+/*
+ * update_peak - fold the current heap + mapped bytes into the peak
+ */
+static void update_peak(void)
+{
+    size_t total = mem_heap_bytes + mem_map_bytes;
+
+    if (total > mem_peak_total)
+	mem_peak_total = total;
+}
+
+/*
+ * reset_heap - make heap h empty; committed pages stay committed
+ */
+static void reset_heap(heap_t *h)
+{
+    h->brk = h->start_brk;
+    h->peak_brk = h->start_brk;
+}
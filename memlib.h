@@ -3,9 +3,22 @@
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+void *mem_sbrk_at(int heap, int incr);
+size_t mem_trim(void);
+size_t mem_trim_at(int heap);
+void *mem_map(size_t size);
+void mem_unmap(void *ptr, size_t size);
+void *mem_remap(void *ptr, size_t old_size, size_t new_size);
+int mem_is_mapped(void *lo, size_t size);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
+void *mem_heap_lo_at(int heap);
+void *mem_heap_hi_at(int heap);
+int mem_heap_index(void *p);
+int mem_is_heap(void *lo, size_t size);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_peak_footprint(void);
 size_t mem_pagesize(void);
 
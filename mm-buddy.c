@@ -0,0 +1,278 @@
+/*
+ * mm-buddy.c - Binary buddy allocator.
+ *
+ * 모든 블럭의 크기는 2의 거듭제곱(2^order)이며, 힙 시작 주소(g_base)로부터의
+ * 오프셋이 자신의 크기로 정렬되어 있다. 따라서 order k 블럭의 buddy는
+ * 오프셋의 k번째 비트를 뒤집은 (XOR) 위치에 있고, 병합에 footer나 선형 탐색이
+ * 필요 없다.
+ *
+ * - 블럭 앞 DSIZE 바이트는 헤더이며 (order, allocated)만 담는다.
+ * - free block은 헤더 뒤에 order 별 이중 연결 리스트의 pred, succ 포인터를
+ *   담는다.
+ * - malloc은 요청을 담을 수 있는 가장 작은 order의 free block을 찾아 반씩
+ *   쪼개고, free는 buddy가 같은 order의 free block인 동안 계속 병합한다.
+ * - 힙이 부족하면 필요한 order에 맞춰 정렬될 때까지 힙 끝의 빈 공간을
+ *   정렬된 free block들로 채운 뒤 새 블럭을 붙인다.
+ *
+ * mm.c와 같은 mm.h 인터페이스를 구현하므로 `make mdriver-buddy`로 같은
+ * trace에 대해 점수를 비교할 수 있다.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+typedef char *byte_p;
+
+team_t team = {
+    /* Team name */
+    "swjungle-week05-team08",
+    /* First member's full name */
+    "ChoiWheatley",
+    /* First member's email address */
+    "chltmdgus604@gmail.com",
+    /* Second member's full name (leave blank if none) */
+    "",
+    /* Second member's email address (leave blank if none) */
+    ""};
+
+/**
+ * SECTION Constants and Macros
+ */
+#define DSIZE 8  // 헤더 크기, payload 정렬 단위 in bytes
+// 헤더 + pred + succ 포인터를 담을 수 있는 최소 order
+#define MIN_ORDER (sizeof(void *) == 4 ? 4 : 5)
+#define MAX_ORDER 31
+
+#define BLOCK_SIZE(order) ((size_t)1 << (order))
+
+// header에 들어갈 정보 (order, allocated)를 묶는다.
+#define PACK(order, alloc) (((order) << 1) | (alloc))
+#define GET(p) (*(unsigned int *)(p))
+#define PUT(p, val) (*(unsigned int *)(p) = (val))
+#define GET_ORDER(blk) (GET(blk) >> 1)
+#define GET_ALLOC(blk) (GET(blk) & 0x1)
+
+// blk는 헤더의 시작 주소, payload는 그 뒤 DSIZE 바이트부터 시작한다.
+#define PAYLOAD(blk) ((byte_p)(blk) + DSIZE)
+#define BLOCK(bp) ((byte_p)(bp)-DSIZE)
+
+#define OFFSET(blk) ((size_t)((byte_p)(blk)-g_base))
+#define BUDDY(blk, order) (g_base + (OFFSET(blk) ^ BLOCK_SIZE(order)))
+
+#define PRED(blk) (*(void **)PAYLOAD(blk))
+#define SUCC(blk) (*((void **)PAYLOAD(blk) + 1))
+///!SECTION
+
+static byte_p g_base;                      // 오프셋 0, 모든 블럭 정렬의 기준
+static void *g_free_list[MAX_ORDER + 1];  // order 별 free block (LIFO)
+
+static int size_order(size_t size);
+static void *grow_heap(int order);
+static void free_block(byte_p blk, int order);
+static void push_block(byte_p blk, int order);
+static void remove_block(byte_p blk, int order);
+inline static bool is_free_buddy(byte_p buddy, int order);
+
+/*
+ * mm_init - free list를 비우고 힙의 시작 주소를 정렬 기준으로 삼는다.
+ */
+int mm_init(void) {
+  if ((g_base = mem_sbrk(0)) == (void *)-1) {
+    return -1;
+  }
+  memset(g_free_list, 0, sizeof(g_free_list));
+  return 0;
+}
+
+/*
+ * mm_malloc - size + 헤더를 담을 수 있는 가장 작은 order의 블럭을 반환한다.
+ *     더 큰 free block밖에 없으면 반씩 쪼개 남는 buddy를 free list에 넣는다.
+ */
+void *mm_malloc(size_t size) {
+  int order, k;
+  byte_p blk;
+
+  if (size == 0) {
+    return NULL;
+  }
+  if ((order = size_order(size + DSIZE)) > MAX_ORDER) {
+    return NULL;
+  }
+
+  for (k = order; k <= MAX_ORDER && g_free_list[k] == NULL; k++) {
+  }
+  if (k > MAX_ORDER) {
+    if ((blk = grow_heap(order)) == NULL) {
+      return NULL;
+    }
+    k = order;
+  } else {
+    blk = g_free_list[k];
+    remove_block(blk, k);
+  }
+
+  // split: 위쪽 절반(buddy)은 free list로 돌려보낸다.
+  while (k > order) {
+    k--;
+    push_block(blk + BLOCK_SIZE(k), k);
+  }
+  PUT(blk, PACK(order, 1));
+  return PAYLOAD(blk);
+}
+
+/*
+ * mm_free - buddy가 같은 order의 free block인 동안 병합한다.
+ */
+void mm_free(void *ptr) {
+  if (ptr == NULL) {
+    return;
+  }
+  byte_p blk = BLOCK(ptr);
+  free_block(blk, GET_ORDER(blk));
+}
+
+/**
+ * @brief 줄어들 때는 위쪽 절반들을 떼어내고, 늘어날 때는 위쪽 buddy들이
+ * 모두 free라면 그 자리에서 병합한다. 둘 다 안 되면 새로 할당해 복사한다.
+ */
+void *mm_realloc(void *ptr, size_t size) {
+  if (ptr == NULL) {
+    return mm_malloc(size);
+  }
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+
+  byte_p blk = BLOCK(ptr);
+  int cur = GET_ORDER(blk);
+  int order = size_order(size + DSIZE);
+  int k;
+
+  if (order <= cur) {
+    // shrink in place. 떼어낸 절반의 buddy는 나 자신이므로 병합할 필요 없다.
+    while (cur > order) {
+      cur--;
+      push_block(blk + BLOCK_SIZE(cur), cur);
+    }
+    PUT(blk, PACK(cur, 1));
+    return ptr;
+  }
+
+  // grow in place: 내가 항상 아래쪽 buddy이고 위쪽 buddy가 free여야 한다.
+  for (k = cur; k < order; k++) {
+    if ((OFFSET(blk) & BLOCK_SIZE(k)) != 0 ||
+        !is_free_buddy(BUDDY(blk, k), k)) {
+      break;
+    }
+  }
+  if (k == order) {
+    for (k = cur; k < order; k++) {
+      remove_block(BUDDY(blk, k), k);
+    }
+    PUT(blk, PACK(order, 1));
+    return ptr;
+  }
+
+  void *newptr = mm_malloc(size);
+  if (newptr == NULL) {
+    return NULL;
+  }
+  size_t copy_size = BLOCK_SIZE(cur) - DSIZE;
+  memcpy(newptr, ptr, size < copy_size ? size : copy_size);
+  mm_free(ptr);
+  return newptr;
+}
+
+/**
+ * @brief size 바이트를 담을 수 있는 가장 작은 order
+ */
+int size_order(size_t size) {
+  int order = MIN_ORDER;
+  while (BLOCK_SIZE(order) < size) {
+    order++;
+  }
+  return order;
+}
+
+/**
+ * @brief order 블럭 하나를 힙 끝에 붙인다.
+ *
+ * 새 블럭의 오프셋은 BLOCK_SIZE(order)로 정렬되어야 하므로, 그 전까지 남는
+ * 공간은 현재 힙 끝 오프셋의 가장 낮은 set bit 크기의 블럭들로 채워
+ * free list에 넣는다. 이렇게 만든 블럭들도 모두 자기 크기로 정렬된다.
+ */
+void *grow_heap(int order) {
+  size_t heap_end = (byte_p)mem_heap_hi() + 1 - g_base;
+  size_t aligned = (heap_end + BLOCK_SIZE(order) - 1) & ~(BLOCK_SIZE(order) - 1);
+  byte_p blk;
+
+  while (heap_end < aligned) {
+    int k = __builtin_ctzl(heap_end);
+    if ((blk = mem_sbrk(BLOCK_SIZE(k))) == (void *)-1) {
+      return NULL;
+    }
+    heap_end += BLOCK_SIZE(k);
+    free_block(blk, k);
+  }
+  if ((blk = mem_sbrk(BLOCK_SIZE(order))) == (void *)-1) {
+    return NULL;
+  }
+  return blk;
+}
+
+/**
+ * @brief blk를 free 상태로 만들고 buddy와 가능한 만큼 병합한다.
+ */
+void free_block(byte_p blk, int order) {
+  while (order < MAX_ORDER) {
+    byte_p buddy = BUDDY(blk, order);
+    if (!is_free_buddy(buddy, order)) {
+      break;
+    }
+    remove_block(buddy, order);
+    if (buddy < blk) {
+      blk = buddy;
+    }
+    order++;
+  }
+  push_block(blk, order);
+}
+
+/**
+ * @brief buddy가 힙 안에 있고, 쪼개지지 않은 같은 order의 free block인지
+ */
+inline bool is_free_buddy(byte_p buddy, int order) {
+  return buddy + BLOCK_SIZE(order) <= (byte_p)mem_heap_hi() + 1 &&
+         !GET_ALLOC(buddy) && GET_ORDER(buddy) == (unsigned int)order;
+}
+
+void push_block(byte_p blk, int order) {
+  PUT(blk, PACK(order, 0));
+  PRED(blk) = NULL;
+  SUCC(blk) = g_free_list[order];
+  if (g_free_list[order] != NULL) {
+    PRED(g_free_list[order]) = blk;
+  }
+  g_free_list[order] = blk;
+}
+
+void remove_block(byte_p blk, int order) {
+  void *pred = PRED(blk);
+  void *succ = SUCC(blk);
+
+  if (pred != NULL) {
+    SUCC(pred) = succ;
+  } else {
+    g_free_list[order] = succ;
+  }
+  if (succ != NULL) {
+    PRED(succ) = pred;
+  }
+}
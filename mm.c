@@ -13,31 +13,74 @@
 
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "config.h"
 #include "memlib.h"
 
+#ifdef MM_THREADS
+#include <pthread.h>
+#endif
+
 typedef char *byte_p;
 typedef unsigned long dword_t;
+typedef struct arena_t arena_t;
 
 int mm_init(void);
 void *mm_malloc(size_t size);
 void *mm_realloc(void *ptr, size_t size);
-static void *extend_heap(size_t words);
-static void *coalesce(byte_p bp);
-static void *find_fit(size_t asize);
-static void place(void *bp, size_t asize);
+static void *extend_heap(arena_t *a, size_t words);
+static void trim_heap(arena_t *a, void *bp);
+static void *coalesce(arena_t *a, byte_p bp);
+static void *find_fit(arena_t *a, size_t asize);
+static void *find_reserve(arena_t *a, size_t asize);
+static void free_block(arena_t *a, void *bp);
+static void push_quick(arena_t *a, void *bp, size_t size);
+static void *pop_quick(arena_t *a, int i);
+static void flush_quick(arena_t *a, int i);
+static bool flush_all_quick(arena_t *a, size_t asize);
+static void *map_block(size_t size);
+static void *remap_block(void *bp, size_t size);
+static int init_arena(arena_t *a);
+static arena_t *my_arena(void);
+static void *arena_malloc(arena_t *a, size_t size);
+static void arena_free(arena_t *a, void *ptr);
+static void *arena_realloc(arena_t *a, void *bp, size_t size);
+#ifdef MM_THREADS
+static void push_remote(arena_t *a, void *bp);
+static void drain_remote(arena_t *a);
+typedef struct tcache_t tcache_t;
+static tcache_t *my_tcache(void);
+static int tcache_bin(size_t size);
+static int block_bin(void *ptr);
+static int tcache_refill(tcache_t *tc, int bin, size_t size);
+static void tcache_flush(tcache_t *tc, int bin, unsigned int n);
+static void tcache_destroy(void *tc);
+#endif
+static void place(arena_t *a, void *bp, size_t asize);
+static void *trim_block(arena_t *a, void *bp, size_t asize);
+static void *finish_grow(arena_t *a, void *bp, size_t asize, bool reserve);
+static void *place_grow(arena_t *a, void *bp, size_t asize);
+static void insert_reserve(arena_t *a, void *bp);
+static void insert_free_block(arena_t *a, void *bp);
+static void remove_free_block(arena_t *a, void *bp);
+static void insert_tree(arena_t *a, void *bp);
+static void remove_tree(arena_t *a, void *bp);
+static void *find_tree(arena_t *a, size_t asize);
+inline static int size_class(size_t size);
+static void *slab_malloc(arena_t *a, int cls);
+static void slab_free(arena_t *a, void *run, void *ptr);
+static void *new_run(arena_t *a, int cls);
+static void *carve_run(arena_t *a);
+inline static bool is_run(void *run);
+inline static void set_run(void *run, bool on);
 inline static size_t adjust_size(size_t size);
 inline static bool is_prologue(void *bp);
 inline static bool is_epilogue(void *bp);
-void *first_fit(size_t asize);
-void *next_fit(size_t asize);
-
-void *g_heap_listp;
-void *g_cur;
 
 /*********************************************************
  * NOTE TO STUDENTS: Before you do anything else, please
@@ -55,47 +98,312 @@ team_t team = {
     /* Second member's email address (leave blank if none) */
     ""};
 
-/* single word (4) or double word (8) alignment */
-#define ALIGNMENT 8
-
-/* rounds up to the nearest multiple of ALIGNMENT */
-#define ALIGN(size) (((size) + (ALIGNMENT - 1)) & ~0x7)
+/**
+ * SECTION Block Word Layout
+ * 헤더/푸터 한 워드의 타입. GET/PUT이 포인터 크기와 상관없이 이 타입만
+ * 읽고 쓰므로 -m32와 x86-64 빌드에서 같은 블럭 형식을 쓴다. 힙이 MAX_HEAP
+ * (20MB)을 넘지 않으므로 기본은 32비트 헤더에 8바이트 정렬이고,
+ * WIDE_HEADER를 켜면 64비트 헤더에 16바이트 정렬을 쓴다.
+ */
+#define WIDE_HEADER 0
 
-#define SIZE_T_SIZE (ALIGN(sizeof(size_t)))
+#if WIDE_HEADER
+typedef uint64_t word_t;
+#else
+typedef uint32_t word_t;
+#endif
+///!SECTION
 
 /**
  * SECTION Constants and Macros
  * Figure 9.43 코드가 누락되어 추가함.
  */
-#define WSIZE 4  //  워드 사이즈 (헤더, 푸터 사이즈) in bytes
-#define DSIZE 8  // 더블 워드 사이즈 in bytes
+#define WSIZE sizeof(word_t)  //  워드 사이즈 (헤더, 푸터 사이즈) in bytes
+#define DSIZE (2 * WSIZE)     // 더블 워드 사이즈, 정렬 단위 in bytes
 #define CHUNKSIZE (1 << 12)  // 힙 추가 시 요청할 크기 in bytes
-#define MINIMUM_BLOCK_SIZE WSIZE * 2  // header, footer
+// 힙 끝의 free block이 TRIM_THRESHOLD보다 크면 TRIM_PAD만 남기고 힙을 줄인다.
+#define TRIM_THRESHOLD (1 << 18)
+#define TRIM_PAD (1 << 16)
+// free block의 header, footer + free list 의 pred, succ 링크
+#define MINIMUM_BLOCK_SIZE ALIGN(2 * WSIZE + 2 * sizeof(link_t))
 
 #define MAX(x, y) ((x) > (y) ? (x) : (y))
 
-// header, footer에 들어갈 정보 (blocksize, allocated)를 묶는다.
-#define PACK(size, alloc) ((size) | (alloc))
+// rounds up to the nearest multiple of DSIZE
+#define ALIGN(size) (((size) + (DSIZE - 1)) & ~(DSIZE - 1))
+
+// header, footer에 들어갈 정보 (blocksize, prev allocated, allocated)를
+// 묶는다. 할당된 블럭은 footer가 없으므로, 다음 블럭은 헤더의 prev_alloc
+// 비트로 이전 블럭의 할당 여부를 알아낸다.
+#define PACK(size, prev_alloc, alloc) ((size) | ((prev_alloc) << 1) | (alloc))
 
 // read and write a word at address p
-#define GET(p) (*(size_t *)(p))
-#define PUT(p, val) (*(size_t *)(p) = (val))
+#define GET(p) (*(word_t *)(p))
+#define PUT(p, val) (*(word_t *)(p) = (val))
 
 // Unpack and Read specific field from address p
 #define GET_SIZE(p) (size_t)(GET(p) & ~0x7)
 #define GET_ALLOC(p) (GET(p) & 0x01)
+#define GET_PREV_ALLOC(p) ((GET(p) & 0x02) >> 1)
+
+// 다음 블럭 헤더의 prev_alloc 비트를 갱신한다.
+// MM_THREADS에서는 그 블럭이 할당된 상태라면 다른 스레드가 lock 없이
+// block_bin으로 헤더를 읽고 있을 수 있으므로 atomic으로 바꾼다.
+#ifdef MM_THREADS
+#define SET_PREV_ALLOC(bp) \
+  __atomic_fetch_or((word_t *)HEADER_PTR(bp), 0x02, __ATOMIC_RELAXED)
+#define CLEAR_PREV_ALLOC(bp) \
+  __atomic_fetch_and((word_t *)HEADER_PTR(bp), ~(word_t)0x02, __ATOMIC_RELAXED)
+#else
+#define SET_PREV_ALLOC(bp) PUT(HEADER_PTR(bp), GET(HEADER_PTR(bp)) | 0x02)
+#define CLEAR_PREV_ALLOC(bp) PUT(HEADER_PTR(bp), GET(HEADER_PTR(bp)) & ~0x02)
+#endif
+
+// 남는 세번째 비트. 할당된 블럭에서는 realloc으로 늘어난 적이 있음을,
+// free block에서는 reserve list에 들어있음을 뜻한다.
+#define GET_TAG(p) (GET(p) & 0x04)
+#define SET_TAG(bp) PUT(HEADER_PTR(bp), GET(HEADER_PTR(bp)) | 0x04)
 
 // 헤더 포인터의 주소를 가리킨다. p는 payload의 첫번째 주소를 가리킨다.
 #define HEADER_PTR(bp) (void *)((byte_p)(bp)-WSIZE)
 // 푸터 포인터의 주소를 가리킨다. p는 payload의 첫번째 주소를 가리킨다.
+// free block에만 푸터가 존재한다.
 #define FOOTER_PTR(bp) ((byte_p)(bp) + GET_SIZE(HEADER_PTR(bp)) - DSIZE)
 
 // 다음 블럭의 bp(base pointer)를 가리킨다.
 #define NEXT_BLOCK_PTR(bp) (void *)((byte_p)(bp) + GET_SIZE(HEADER_PTR(bp)))
-// 이전 블럭의 bp(base pointer)를 가리킨다.
+// 이전 블럭의 bp(base pointer)를 가리킨다. 이전 블럭이 free일 때만 유효하다.
 #define PREV_BLOCK_PTR(bp) (void *)((byte_p)(bp)-GET_SIZE(((byte_p)(bp)-DSIZE)))
 ///!SECTION
 
+/**
+ * SECTION Segregated Free Lists
+ * free block의 payload 앞부분에 이전(pred), 다음(succ) free block의 링크를
+ * 저장하여 size class 별 이중 연결 리스트를 만든다.
+ *
+ * 링크는 포인터 대신 첫 힙의 시작(g_heap_base)으로부터의 32비트 오프셋이다.
+ * arena 힙들은 그 뒤로 MAX_HEAP 간격으로 붙어 있고 모두 합쳐도 4GB를 넘지
+ * 않으므로 오프셋은 항상 32비트에 들어가고, 64비트 빌드에서도 최소 블럭이
+ * 16바이트로 유지된다. 오프셋 0은 첫 힙의 첫 워드(alignment padding)이므로
+ * NULL을 뜻한다.
+ *
+ * | header | pred | succ | ... | footer |
+ */
+#define NUM_CLASSES 8       // size class 개수, TREE_MIN_SIZE 미만만 담는다.
+#define MIN_CLASS_SHIFT 4   // class 0 = [16, 32), class 1 = [32, 64), ...
+#define SEG_BEST_FIT 1      // 0: class 내 first fit, 1: class 내 best fit
+
+#define LINK(bp, i) (((link_t *)(bp))[i])
+#define TO_LINK(bp) \
+  ((bp) != NULL ? (link_t)((byte_p)(bp)-g_heap_base) : (link_t)0)
+#define FROM_LINK(l) ((l) != 0 ? (void *)(g_heap_base + (l)) : NULL)
+
+#define PRED(bp) FROM_LINK(LINK(bp, 0))
+#define SUCC(bp) FROM_LINK(LINK(bp, 1))
+#define SET_PRED(bp, p) (LINK(bp, 0) = TO_LINK(p))
+#define SET_SUCC(bp, p) (LINK(bp, 1) = TO_LINK(p))
+
+typedef uint32_t link_t;
+
+static byte_p g_heap_base;  // 링크 오프셋의 기준, mem_heap_lo_at(0)
+///!SECTION
+
+/**
+ * SECTION Best Fit Tree
+ * TREE_MIN_SIZE 이상의 free block은 크기를 key로 하는 treap에 넣어 O(log n)에
+ * 가장 딱 맞는 블럭을 찾는다. 노드의 우선순위는 크기의 해시값이므로 따로
+ * 저장하지 않는다. 같은 크기의 블럭은 트리 노드 하나에 pred, succ로 매달린
+ * 체인을 이루며, 체인의 첫 블럭만 트리 노드이다. (트리 노드는 PRED가 NULL이다.)
+ *
+ * | header | pred | succ | left | right | ... | footer |
+ */
+#define TREE_MIN_SIZE (1 << (MIN_CLASS_SHIFT + NUM_CLASSES))
+
+// 자식 링크 자체. insert/remove는 이 링크의 주소를 들고 내려간다.
+#define LEFT_LINK(bp) LINK(bp, 2)
+#define RIGHT_LINK(bp) LINK(bp, 3)
+#define LEFT(bp) FROM_LINK(LEFT_LINK(bp))
+#define RIGHT(bp) FROM_LINK(RIGHT_LINK(bp))
+#define NODE_SIZE(bp) GET_SIZE(HEADER_PTR(bp))
+// Knuth multiplicative hash, 크기의 하위 3비트는 항상 0이다.
+#define TREE_PRIO(size) ((unsigned int)((size) >> 3) * 2654435761u)
+///!SECTION
+
+/**
+ * SECTION Realloc Growth Reserve
+ * realloc으로 두 번 이상 늘어나는 블럭은 다음 성장을 위해 RESERVE_SIZE 만큼
+ * 여유를 두고, 그 여유분은 블럭 바로 뒤의 태그 달린 free block으로 남긴다.
+ * reserve block은 일반 free list가 아닌 reserve list에 들어가므로 평소에는
+ * 주인 블럭이 다음 realloc에서 그대로 흡수하고, 일반 탐색이 실패했을 때만
+ * 다른 요청이 가져간다. 여유분이 블럭 크기에 비례하므로 복사 횟수는
+ * 성장량에 대해 amortized O(1)이다.
+ */
+#define RESERVE_SIZE(asize) ALIGN((asize) / 2)
+///!SECTION
+
+/**
+ * SECTION Quick Lists
+ * SLAB_MAX_SIZE 보다 크고 QUICK_MAX_SIZE 이하인 블럭은 free 해도 바로 병합하지
+ * 않고, 할당 상태 그대로 크기별 LIFO 리스트에 넣어 두었다가 같은 크기의
+ * malloc에 그대로 돌려준다. 헤더가 할당 상태이므로 이웃 블럭은 이 블럭과
+ * 병합하지 않는다. 리스트가 QUICK_MAX_COUNT 만큼 차거나, fit 탐색이 실패했는데
+ * 모아둔 블럭을 합치면 요청을 담을 수도 있을 때 한꺼번에 free 하여 병합한다.
+ *
+ * | header | next | ... |
+ */
+#define QUICK_MAX_SIZE 512
+#define QUICK_MAX_COUNT 32
+#define NUM_QUICK_LISTS (QUICK_MAX_SIZE / DSIZE + 1)
+#define QUICK_INDEX(size) ((size) / DSIZE)
+#define NEXT_QUICK(bp) LINK(bp, 0)
+///!SECTION
+
+/**
+ * SECTION Mapped Blocks
+ * MMAP_THRESHOLD 이상의 요청은 힙이 아닌 mem_map으로 받은 전용 영역에 둔다.
+ * free하면 영역째 돌려주므로 잠깐 쓰는 큰 버퍼가 힙을 부풀리거나 조각내지
+ * 않고, realloc은 mem_remap으로 복사 없이 늘린다. 영역의 첫 DSIZE 바이트에
+ * 영역 크기를 적고 그 뒤가 payload이다. 힙 예약 범위 밖의 주소이므로 주소만
+ * 보고 힙 블럭과 구별한다.
+ *
+ * | map size | payload ... |
+ */
+#define MMAP_THRESHOLD (1 << 18)
+
+#define MAP_SIZE(bp) (*(size_t *)((byte_p)(bp)-DSIZE))
+#define IS_MAPPED(bp) \
+  ((uintptr_t)((byte_p)(bp)-g_heap_base) >= (uintptr_t)NUM_ARENAS * MAX_HEAP)
+///!SECTION
+
+/**
+ * SECTION Slab Runs
+ * SLAB_MAX_SIZE 이하의 작은 요청은 힙에서 RUN_SIZE 크기, RUN_SIZE 정렬의
+ * 할당 블럭(run)을 받아 같은 크기의 slot으로 나누어 처리한다. slot에는 헤더가
+ * 없으며, slot 주소를 RUN_SIZE로 내림하면 run 헤더를 얻는다. 어떤 페이지가
+ * run인지는 g_run_map 비트맵으로 판별한다.
+ *
+ * | header | run_t | slot | slot | ... | (next header) |
+ */
+#define RUN_SIZE (1 << 12)
+#define SLAB_MAX_SIZE 128
+// class i의 slot 크기는 (i + 1) * DSIZE 이다.
+#define NUM_SLAB_CLASSES (SLAB_MAX_SIZE / DSIZE)
+#define SLAB_CLASS(size) (((size)-1) / DSIZE)
+#define RUN_MAP_BYTES (((size_t)NUM_ARENAS * MAX_HEAP / RUN_SIZE + 1) / 8 + 1)
+
+#define RUN_OF(p) ((run_t *)((uintptr_t)(p) & ~(uintptr_t)(RUN_SIZE - 1)))
+// run의 마지막 워드는 다음 블럭의 헤더이다.
+#define RUN_END(run) ((byte_p)(run) + RUN_SIZE - WSIZE)
+#define RUN_FULL(run)       \
+  ((run)->free_slot == NULL && \
+   (run)->unused + (run)->slot_size > RUN_END(run))
+
+typedef struct run_t {
+  struct run_t *prev;  // 빈 slot이 남은 같은 class run 리스트
+  struct run_t *next;
+  void *free_slot;        // 반납된 slot 스택, slot 첫 워드에 다음 slot 주소
+  byte_p unused;          // 아직 한 번도 나눠주지 않은 slot의 시작
+  unsigned int slot_size;
+  unsigned int nused;  // 사용중인 slot 개수
+  int cls;
+} run_t;
+
+#define RUN_HEADER_SIZE ALIGN(sizeof(run_t))
+
+///!SECTION
+
+/**
+ * SECTION Arenas
+ * free list, tree, quick list, slab run 등 힙 블럭을 관리하는 상태는 모두
+ * arena 안에 있다. arena i는 memlib의 heap i를 자기 힙으로 쓰므로 arena끼리
+ * 블럭을 나누어 쓰지 않는다. MM_THREADS로 빌드하면 NUM_HEAPS 개의 arena를
+ * 만들고, 스레드는 처음 malloc할 때 round-robin으로 arena 하나에 묶인다.
+ * free와 realloc은 블럭 주소가 속한 힙으로 주인 arena를 찾아가므로 (ARENA_OF,
+ * mem_heap_index와 같은 계산) 다른 스레드가 할당한 블럭도 해제할 수 있다.
+ * arena마다 lock이 따로 있어 서로 다른 arena의 malloc은 서로 기다리지 않는다.
+ *
+ * 다른 arena에 묶인 스레드가 free한 블럭은 주인 arena의 lock을 잡지 않고
+ * arena의 remote 스택에 CAS 한 번으로 넣는다. 이 arena에 묶인 스레드가 lock을
+ * 잡고 malloc할 때 스택을 통째로 떼어내 (drain_remote) 한꺼번에 free 한다.
+ * 떼어낼 때는 exchange로 비우기만 하므로 pop의 ABA 문제가 없다.
+ *
+ * 힙 블럭 링크의 기준(g_heap_base)과 run 비트맵은 모든 arena가 함께 쓴다.
+ * 비트맵의 바이트는 한 arena의 페이지만 담으므로 arena lock으로 충분하다.
+ */
+#ifdef MM_THREADS
+#define NUM_ARENAS NUM_HEAPS
+#define LOCK(a) pthread_mutex_lock(&(a)->lock)
+#define UNLOCK(a) pthread_mutex_unlock(&(a)->lock)
+// memlib은 heap i를 heap 0의 시작에서 i * MAX_HEAP 떨어진 곳에 둔다.
+#define ARENA_OF(bp) \
+  (&g_arenas[(uintptr_t)((byte_p)(bp)-g_heap_base) / MAX_HEAP])
+#define REMOTE_NEXT(bp) (*(void **)(bp))
+#else
+#define NUM_ARENAS 1
+#define LOCK(a)
+#define UNLOCK(a)
+#define ARENA_OF(bp) (&g_arenas[0])
+#endif
+
+struct arena_t {
+  int heap;    // memlib heap 번호
+  bool ready;  // 힙을 만들었는지, mm_init 이후 처음 쓸 때 만든다.
+  void *heap_listp;  // 프롤로그 블럭
+  void *seg_list[NUM_CLASSES];  // class 별 free list의 첫번째 블럭 (LIFO)
+  link_t tree_root;
+  void *reserve_list;
+  link_t quick[NUM_QUICK_LISTS];  // 크기별 quick list (LIFO)
+  unsigned int quick_count[NUM_QUICK_LISTS];
+  size_t quick_bytes;  // 모든 quick list에 든 블럭 크기의 합
+  run_t *runs[NUM_SLAB_CLASSES];  // class 별 빈 slot이 남은 run
+#ifdef MM_THREADS
+  pthread_mutex_t lock;
+  void *remote;  // 다른 arena의 스레드가 free한 블럭 스택
+#endif
+};
+
+static arena_t g_arenas[NUM_ARENAS];
+static unsigned char g_run_map[RUN_MAP_BYTES];  // 페이지 별 run 여부
+static byte_p g_run_base;  // g_run_map 0번 비트에 해당하는 페이지
+#ifdef MM_THREADS
+static __thread arena_t *t_arena;  // 이 스레드가 malloc에 쓰는 arena
+static unsigned int g_next_arena;  // 다음 스레드에 줄 arena 번호
+#endif
+///!SECTION
+
+/**
+ * SECTION Thread Caches
+ * MM_THREADS 빌드에서는 스레드마다 작은 블럭을 bin 별로 TCACHE_COUNT 개까지
+ * 쥐고 있는 캐시를 둔다. bin은 slab class 뒤에 quick list 크기를 이어붙인
+ * 것이다. 캐시에 든 블럭은 arena가 보기엔 할당 상태이므로, mm_malloc과
+ * mm_free는 lock 없이 캐시의 LIFO 리스트만 고친다. 캐시가 비면 자기 arena의
+ * lock을 한 번 잡고 TCACHE_BATCH 개를 받아오고, 가득 차면 TCACHE_BATCH 개를
+ * 각자의 주인 arena에 돌려준다. 스레드가 끝날 때 남은 블럭을 모두 돌려준다.
+ *
+ * mm_init은 힙을 새로 만들므로 g_epoch를 올려 이전 힙의 블럭이 든 캐시를
+ * 버리게 한다.
+ *
+ * | next | ... |
+ */
+#ifdef MM_THREADS
+#define TCACHE_COUNT 32
+#define TCACHE_BATCH (TCACHE_COUNT / 2)
+#define NUM_TCACHE_BINS (NUM_SLAB_CLASSES + NUM_QUICK_LISTS)
+#define TCACHE_NEXT(p) (*(void **)(p))
+
+struct tcache_t {
+  unsigned int epoch;  // g_epoch와 다르면 빈 캐시로 본다.
+  unsigned int count[NUM_TCACHE_BINS];
+  void *head[NUM_TCACHE_BINS];
+};
+
+static __thread tcache_t t_cache;
+static unsigned int g_epoch;         // mm_init 마다 1씩 증가
+static pthread_key_t g_tcache_key;  // 스레드가 끝나면 tcache_destroy 호출
+static pthread_once_t g_tcache_once = PTHREAD_ONCE_INIT;
+#endif
+///!SECTION
+
 /**
  * Helper Functions
  */
@@ -110,36 +418,344 @@ static void *__prev_block_ptr(void *bp) { return PREV_BLOCK_PTR(bp); }
 /*
  * # mm_init - initialize the malloc package.
  *
+ * 모든 arena를 비우고 첫 arena의 힙만 바로 만든다. 나머지 arena의 힙은
+ * 그 arena에 묶인 스레드가 처음 malloc할 때 만든다.
+ */
+int mm_init(void) {
+#ifdef MM_THREADS
+  static bool locks_ready;
+#endif
+
+  g_heap_base = mem_heap_lo_at(0);
+  memset(g_run_map, 0, sizeof(g_run_map));
+  g_run_base = (byte_p)RUN_OF(g_heap_base);
+
+  for (int i = 0; i < NUM_ARENAS; i++) {
+    g_arenas[i].heap = i;
+    g_arenas[i].ready = false;
+#ifdef MM_THREADS
+    g_arenas[i].remote = NULL;
+    if (!locks_ready) {
+      pthread_mutex_init(&g_arenas[i].lock, NULL);
+    }
+#endif
+  }
+#ifdef MM_THREADS
+  locks_ready = true;
+  g_epoch++;
+#endif
+  return init_arena(&g_arenas[0]);
+}
+
+/*
+ * mm_malloc - 이 스레드의 arena에서 블럭을 할당한다. 작은 블럭은 스레드
+ *     캐시에서 먼저 꺼낸다.
+ */
+void *mm_malloc(size_t size) {
+#ifdef MM_THREADS
+  int bin = tcache_bin(size);
+  if (bin >= 0) {
+    tcache_t *tc = my_tcache();
+    if (tc->head[bin] == NULL && tcache_refill(tc, bin, size) == 0) {
+      return NULL;
+    }
+    void *bp = tc->head[bin];
+    tc->head[bin] = TCACHE_NEXT(bp);
+    tc->count[bin]--;
+    return bp;
+  }
+#endif
+  arena_t *a = my_arena();
+  void *bp;
+
+  LOCK(a);
+#ifdef MM_THREADS
+  drain_remote(a);
+#endif
+  bp = arena_malloc(a, size);
+  UNLOCK(a);
+  return bp;
+}
+
+/*
+ * mm_free - 블럭을 그 블럭이 속한 arena에 돌려준다. 작은 블럭은 스레드
+ *     캐시에 넣어 두고, 캐시가 차면 절반을 한꺼번에 돌려준다. 다른 arena의
+ *     블럭은 lock 없이 그 arena의 remote 스택에 넣는다.
+ */
+void mm_free(void *ptr) {
+  if (IS_MAPPED(ptr)) {
+    mem_unmap((byte_p)ptr - DSIZE, MAP_SIZE(ptr));
+    return;
+  }
+#ifdef MM_THREADS
+  int bin = block_bin(ptr);
+  if (bin >= 0) {
+    tcache_t *tc = my_tcache();
+    if (tc->count[bin] == TCACHE_COUNT) {
+      tcache_flush(tc, bin, TCACHE_BATCH);
+    }
+    TCACHE_NEXT(ptr) = tc->head[bin];
+    tc->head[bin] = ptr;
+    tc->count[bin]++;
+    return;
+  }
+#endif
+
+  arena_t *a = ARENA_OF(ptr);
+
+#ifdef MM_THREADS
+  if (a != my_arena()) {
+    push_remote(a, ptr);
+    return;
+  }
+#endif
+  LOCK(a);
+  arena_free(a, ptr);
+  UNLOCK(a);
+}
+
+/*
+ * mm_realloc - 힙 블럭은 그 블럭이 속한 arena 안에서 크기를 바꾼다.
+ */
+void *mm_realloc(void *ptr, size_t size) {
+  void *newptr;
+
+  if (ptr == NULL) {
+    return mm_malloc(size);
+  }
+  if (size == 0) {
+    mm_free(ptr);
+    return NULL;
+  }
+
+  if (IS_MAPPED(ptr)) {
+    // 여전히 크면 영역째 늘리거나 줄이고, 충분히 작아지면 힙으로 옮긴다.
+    if (size >= MMAP_THRESHOLD / 2) {
+      return remap_block(ptr, size);
+    }
+    if ((newptr = mm_malloc(size)) == NULL) {
+      return NULL;
+    }
+    memcpy(newptr, ptr, size);
+    mm_free(ptr);
+    return newptr;
+  }
+
+  arena_t *a = ARENA_OF(ptr);
+
+  LOCK(a);
+  newptr = arena_realloc(a, ptr, size);
+  UNLOCK(a);
+  return newptr;
+}
+
+/**
+ * @brief arena의 힙을 새로 만든다.
+ *
  * Figure 9.42에 따르면, 힙 시작 첫번째 워드는 정렬을 위해 사용하지 않으며,
  * 0으로 초기화 되어있다. 바로 뒤에는 프롤로그 블록이 나오며, 페이로드 없이
  * 헤더와 푸터만 존재한다. 힙 영역 마지막 워드는 에필로그 블록으로,
  * 블록사이즈가 0으로 초기화 되어있다.
  */
-int mm_init(void) {
+int init_arena(arena_t *a) {
+  byte_p heap_listp;
+
   // 비어있는 힙 생성
-  if (((g_heap_listp) = mem_sbrk(4 * WSIZE)) == (void *)-1) {
+  if ((heap_listp = mem_sbrk_at(a->heap, 4 * WSIZE)) == (void *)-1) {
     return -1;
   }
-  PUT(g_heap_listp, 0);                             // alignment padding
-  PUT(g_heap_listp + (1 * WSIZE), PACK(DSIZE, 1));  // prologue header
-  PUT(g_heap_listp + (2 * WSIZE), PACK(DSIZE, 1));  // prologue footer
-  PUT(g_heap_listp + (3 * WSIZE), PACK(0, 1));      // epilogue header
-  g_heap_listp += (2 * WSIZE);
+  PUT(heap_listp, 0);                             // alignment padding
+  PUT(heap_listp + (1 * WSIZE), PACK(DSIZE, 1, 1));  // prologue header
+  PUT(heap_listp + (2 * WSIZE), PACK(DSIZE, 1, 1));  // prologue footer
+  PUT(heap_listp + (3 * WSIZE), PACK(0, 1, 1));      // epilogue header
+  a->heap_listp = heap_listp + (2 * WSIZE);
 
-  g_cur = g_heap_listp;
+  memset(a->seg_list, 0, sizeof(a->seg_list));
+  a->tree_root = 0;
+  a->reserve_list = NULL;
+  memset(a->quick, 0, sizeof(a->quick));
+  memset(a->quick_count, 0, sizeof(a->quick_count));
+  a->quick_bytes = 0;
+  memset(a->runs, 0, sizeof(a->runs));
 
   // Extend the empty heap with a free block of CHUNKSIZE bytes
-  if (extend_heap(CHUNKSIZE / WSIZE) == NULL) {
+  if (extend_heap(a, CHUNKSIZE / WSIZE) == NULL) {
     return -1;
   }
+  a->ready = true;
   return 0;
 }
 
-/*
- * mm_malloc - Allocate a block by incrementing the brk pointer.
+/**
+ * @brief 이 스레드가 malloc에 쓰는 arena. 처음 부를 때 round-robin으로
+ * 정한다.
+ */
+arena_t *my_arena(void) {
+#ifdef MM_THREADS
+  if (t_arena == NULL) {
+    unsigned int i = __atomic_fetch_add(&g_next_arena, 1, __ATOMIC_RELAXED);
+    t_arena = &g_arenas[i % NUM_ARENAS];
+  }
+  return t_arena;
+#else
+  return &g_arenas[0];
+#endif
+}
+
+#ifdef MM_THREADS
+/**
+ * @brief 다른 arena의 스레드가 free한 블럭 bp를 a의 remote 스택에 넣는다.
+ */
+void push_remote(arena_t *a, void *bp) {
+  void *head = __atomic_load_n(&a->remote, __ATOMIC_RELAXED);
+
+  do {
+    REMOTE_NEXT(bp) = head;
+  } while (!__atomic_compare_exchange_n(&a->remote, &head, bp, true,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/**
+ * @brief a의 remote 스택을 비우고 모든 블럭을 free 한다. a의 lock을 잡고
+ * 불러야 한다.
+ */
+void drain_remote(arena_t *a) {
+  if (__atomic_load_n(&a->remote, __ATOMIC_RELAXED) == NULL) {
+    return;
+  }
+  void *bp = __atomic_exchange_n(&a->remote, NULL, __ATOMIC_ACQUIRE);
+  while (bp != NULL) {
+    void *next = REMOTE_NEXT(bp);
+    arena_free(a, bp);
+    bp = next;
+  }
+}
+
+static void create_tcache_key(void) {
+  pthread_key_create(&g_tcache_key, tcache_destroy);
+}
+
+/**
+ * @brief 이 스레드의 캐시. 마지막 mm_init 이전에 채운 캐시라면 비운다.
+ */
+tcache_t *my_tcache(void) {
+  tcache_t *tc = &t_cache;
+
+  if (tc->epoch != g_epoch) {
+    memset(tc, 0, sizeof(*tc));
+    tc->epoch = g_epoch;
+    pthread_once(&g_tcache_once, create_tcache_key);
+    pthread_setspecific(g_tcache_key, tc);
+  }
+  return tc;
+}
+
+/**
+ * @brief size 바이트 요청에 쓸 bin. 캐시하지 않는 크기면 -1
+ */
+int tcache_bin(size_t size) {
+  if (size == 0) {
+    return -1;
+  }
+  if (size <= SLAB_MAX_SIZE) {
+    return SLAB_CLASS(size);
+  }
+  size_t asize = adjust_size(size);
+  return asize <= QUICK_MAX_SIZE ? NUM_SLAB_CLASSES + QUICK_INDEX(asize) : -1;
+}
+
+/**
+ * @brief 할당된 블럭 ptr을 넣을 bin. 캐시하지 않는 블럭이면 -1
+ *
+ * 다른 스레드는 이 블럭 헤더의 prev_alloc 비트만 바꿀 수 있고, 그것도
+ * SET/CLEAR_PREV_ALLOC의 atomic 연산으로만 바꾸므로 lock 없이 크기를 읽어도
+ * 된다.
+ */
+int block_bin(void *ptr) {
+  if (is_run(RUN_OF(ptr))) {
+    return RUN_OF(ptr)->cls;
+  }
+  size_t size =
+      __atomic_load_n((word_t *)HEADER_PTR(ptr), __ATOMIC_RELAXED) & ~0x7;
+  if (SLAB_MAX_SIZE < size && size <= QUICK_MAX_SIZE) {
+    return NUM_SLAB_CLASSES + QUICK_INDEX(size);
+  }
+  return -1;
+}
+
+/**
+ * @brief 자기 arena에서 size 바이트 블럭을 TCACHE_BATCH 개 받아 bin에 넣는다.
+ *
+ * @return 받아온 블럭 수
+ */
+int tcache_refill(tcache_t *tc, int bin, size_t size) {
+  arena_t *a = my_arena();
+  int n;
+
+  LOCK(a);
+  drain_remote(a);
+  for (n = 0; n < TCACHE_BATCH; n++) {
+    void *bp = arena_malloc(a, size);
+    if (bp == NULL) {
+      break;
+    }
+    TCACHE_NEXT(bp) = tc->head[bin];
+    tc->head[bin] = bp;
+  }
+  UNLOCK(a);
+  tc->count[bin] += n;
+  return n;
+}
+
+/**
+ * @brief bin의 블럭 n개를 각자의 주인 arena에 돌려준다. 자기 arena의 블럭은
+ * lock을 한 번만 잡고 free 하고, 다른 arena의 블럭은 remote 스택에 넣는다.
+ */
+void tcache_flush(tcache_t *tc, int bin, unsigned int n) {
+  arena_t *mine = my_arena();
+  bool locked = false;
+
+  for (; n > 0 && tc->head[bin] != NULL; n--) {
+    void *bp = tc->head[bin];
+    arena_t *a = ARENA_OF(bp);
+
+    tc->head[bin] = TCACHE_NEXT(bp);
+    tc->count[bin]--;
+    if (a != mine) {
+      push_remote(a, bp);
+      continue;
+    }
+    if (!locked) {
+      LOCK(mine);
+      locked = true;
+    }
+    arena_free(mine, bp);
+  }
+  if (locked) {
+    UNLOCK(mine);
+  }
+}
+
+/**
+ * @brief 스레드가 끝날 때 캐시에 남은 블럭을 모두 돌려준다.
+ */
+void tcache_destroy(void *p) {
+  tcache_t *tc = p;
+
+  if (tc->epoch != g_epoch) {
+    return;
+  }
+  for (int bin = 0; bin < NUM_TCACHE_BINS; bin++) {
+    tcache_flush(tc, bin, tc->count[bin]);
+  }
+}
+#endif
+
+/**
+ * @brief Allocate a block by incrementing the brk pointer.
  *     Always allocate a block whose size is a multiple of the alignment.
  */
-void *mm_malloc(size_t size) {
+void *arena_malloc(arena_t *a, size_t size) {
   size_t asize;       // adjusted block size
   size_t extendsize;  // amount to extend heap if no fit
   byte_p bp;
@@ -148,76 +764,167 @@ void *mm_malloc(size_t size) {
   if (size == 0) {
     return NULL;
   }
+  if (!a->ready && init_arena(a) == -1) {
+    return NULL;
+  }
+
+  // 작은 요청은 slab run에서 헤더 없는 slot을 꺼낸다.
+  if (size <= SLAB_MAX_SIZE) {
+    return slab_malloc(a, SLAB_CLASS(size));
+  }
+
+  if (size >= MMAP_THRESHOLD) {
+    return map_block(size);
+  }
 
   // adjust block size to include overhead and alignment requirements
   asize = adjust_size(size);
 
+  // 같은 크기로 free된 블럭이 있으면 헤더를 건드리지 않고 그대로 준다.
+  if (asize <= QUICK_MAX_SIZE && a->quick[QUICK_INDEX(asize)] != 0) {
+    return pop_quick(a, QUICK_INDEX(asize));
+  }
+
   // search the free list for a fit
-  if ((bp = find_fit(asize)) != NULL) {
-    place(bp, asize);
+  bp = find_fit(a, asize);
+  if (bp == NULL && flush_all_quick(a, asize)) {
+    bp = find_fit(a, asize);
+  }
+  if (bp != NULL || (bp = find_reserve(a, asize)) != NULL) {
+    place(a, bp, asize);
     return bp;
   }
 
   // no fit found. get more memory and place the block
   extendsize = MAX(asize, CHUNKSIZE);
-  if ((bp = extend_heap(extendsize / WSIZE)) == NULL) {
+  if ((bp = extend_heap(a, extendsize / WSIZE)) == NULL) {
     return NULL;
   }
-  place(bp, asize);
+  place(a, bp, asize);
   return bp;
 }
 
-/*
- * mm_free - Freeing a block does nothing.
+/**
+ * @brief 블럭을 free 상태로 바꾸고 인접 free block과 병합하여 free list에
+ * 넣는다. quick list 크기의 블럭은 병합을 미룬다.
  */
-void mm_free(void *ptr) {
-  size_t size = GET_SIZE(HEADER_PTR(ptr));
+void arena_free(arena_t *a, void *ptr) {
+  if (is_run(RUN_OF(ptr))) {
+    slab_free(a, RUN_OF(ptr), ptr);
+    return;
+  }
 
-  PUT(HEADER_PTR(ptr), PACK(size, 0));
-  PUT(FOOTER_PTR(ptr), PACK(size, 0));
-  coalesce(ptr);
+  size_t size = GET_SIZE(HEADER_PTR(ptr));
+  if (SLAB_MAX_SIZE < size && size <= QUICK_MAX_SIZE) {
+    push_quick(a, ptr, size);
+    return;
+  }
+  free_block(a, ptr);
 }
 
 /**
  * @brief minimize unnecessary allocation
+ *
+ * 새 블럭을 할당하기 전에 다음 순서로 제자리에서 크기를 맞춰본다.
+ * - 줄어들면 남는 뒷부분을 free block으로 떼어낸다.
+ * - 다음 블럭이 free이고 합쳐서 충분하면 흡수한다.
+ * - 힙의 마지막 블럭이면 모자란 만큼만 힙을 늘려 흡수한다.
+ * - 이전 블럭이 free이고 (다음 free block까지) 합쳐서 충분하면 payload를
+ *   앞으로 memmove 한다.
  */
-void *mm_realloc(void *bp, size_t size) {
+void *arena_realloc(arena_t *a, void *bp, size_t size) {
   void *oldptr = bp;
   void *newptr;
   size_t copySize;
 
-  void *next_bp = NEXT_BLOCK_PTR(bp);
-  size_t my_size = GET_SIZE(HEADER_PTR(bp));
-  size_t next_size = GET_SIZE(HEADER_PTR(next_bp));
+  if (is_run(RUN_OF(bp))) {
+    // slot 크기 안에서 줄거나 늘어나면 그대로 둔다.
+    copySize = RUN_OF(bp)->slot_size;
+    if (size <= copySize) {
+      return bp;
+    }
+    if ((newptr = arena_malloc(a, size)) == NULL) {
+      return NULL;
+    }
+    memcpy(newptr, oldptr, copySize);
+    arena_free(a, oldptr);
+    return newptr;
+  }
+
   size_t asize = adjust_size(size);
-  if (!GET_ALLOC(HEADER_PTR(next_bp)) &&
-      asize <= my_size + next_size - MINIMUM_BLOCK_SIZE) {
-    // no need to call malloc
-    dword_t packed = PACK(asize, 1);
-    PUT(HEADER_PTR(bp), packed);
-    PUT(FOOTER_PTR(bp), packed);
-    // refresh free block
-    next_size = my_size + next_size - asize;
-    next_bp = NEXT_BLOCK_PTR(bp);
-    packed = PACK(next_size, 0);
-    PUT(HEADER_PTR(next_bp), packed);
-    PUT(FOOTER_PTR(next_bp), packed);
+  size_t my_size = GET_SIZE(HEADER_PTR(bp));
+  size_t prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
+  // 이미 한 번 늘어난 적 있는 블럭은 다시 늘어날 것으로 보고 여유를 둔다.
+  bool regrow = GET_TAG(HEADER_PTR(bp));
+  size_t reserve = regrow ? RESERVE_SIZE(asize) : 0;
+
+  // shrink in place
+  if (asize <= my_size) {
+    trim_block(a, bp, asize);
     return bp;
   }
 
-  newptr = mm_malloc(size);
+  void *next_bp = NEXT_BLOCK_PTR(bp);
+  size_t next_size =
+      GET_ALLOC(HEADER_PTR(next_bp)) ? 0 : GET_SIZE(HEADER_PTR(next_bp));
+  void *after_bp = next_size > 0 ? NEXT_BLOCK_PTR(next_bp) : next_bp;
+
+  // 힙의 마지막 블럭이라면 모자란 만큼만 힙을 늘린다. extend_heap이 새 영역을
+  // 다음 free block과 병합해주므로 아래 경우와 같이 흡수하면 된다. 힙 끝에서는
+  // 복사 없이 계속 늘릴 수 있으므로 reserve를 두지 않는다.
+  if (my_size + next_size < asize && GET_SIZE(HEADER_PTR(after_bp)) == 0) {
+    size_t delta = MAX(asize - my_size - next_size, MINIMUM_BLOCK_SIZE);
+    if (extend_heap(a, delta / WSIZE) == NULL) {
+      return NULL;
+    }
+    next_size = GET_SIZE(HEADER_PTR(next_bp));
+  }
+
+  // no need to call malloc, 다음 free block을 흡수한다.
+  if (my_size + next_size >= asize) {
+    remove_free_block(a, next_bp);
+    PUT(HEADER_PTR(bp), PACK(my_size + next_size, prev_alloc, 1));
+    SET_PREV_ALLOC(NEXT_BLOCK_PTR(bp));
+    return finish_grow(a, bp, asize, regrow);
+  }
+
+  // 이전 free block (과 다음 free block)을 흡수하고 payload를 앞으로 옮긴다.
+  if (!prev_alloc) {
+    void *prev_bp = PREV_BLOCK_PTR(bp);
+    size_t total = GET_SIZE(HEADER_PTR(prev_bp)) + my_size + next_size;
+    if (total >= asize) {
+      remove_free_block(a, prev_bp);
+      if (next_size > 0) {
+        remove_free_block(a, next_bp);
+      }
+      // free block의 이전 블럭은 항상 할당 상태이다.
+      PUT(HEADER_PTR(prev_bp), PACK(total, 1, 1));
+      SET_PREV_ALLOC(NEXT_BLOCK_PTR(prev_bp));
+      memmove(prev_bp, bp, my_size - WSIZE);
+      return finish_grow(a, prev_bp, asize, regrow);
+    }
+  }
+
+  newptr = arena_malloc(a, size + reserve);
   if (newptr == NULL) return NULL;
-  copySize = *(size_t *)((char *)oldptr - WSIZE) - 1;
+  bool heap_block = !IS_MAPPED(newptr) && !is_run(RUN_OF(newptr));
+  if (heap_block && regrow) {
+    newptr = place_grow(a, newptr, asize);
+  }
+  copySize = my_size - WSIZE;
   if (size < copySize) copySize = size;
   memcpy(newptr, oldptr, copySize);
-  mm_free(oldptr);
-  return newptr;
+  arena_free(a, oldptr);
+  if (!heap_block || regrow) {
+    return newptr;
+  }
+  return finish_grow(a, newptr, asize, false);
 }
 
 /**
  * # extend_heap - 지정한 블록 개수만큼 힙 영역을 추가한다.
  */
-void *extend_heap(size_t words) {
+void *extend_heap(arena_t *a, size_t words) {
   byte_p bp;
   size_t size = words * WSIZE;
 
@@ -225,16 +932,46 @@ void *extend_heap(size_t words) {
   if (words % 2 != 0) {
     size = (words + 1) * WSIZE;
   }
-  if ((long)(bp = mem_sbrk(size)) == -1) {
+  if ((long)(bp = mem_sbrk_at(a->heap, size)) == -1) {
     return NULL;
   }
   // 늘어난 힙 영역대로 헤더 푸터 에필로그 헤더를 재설정한다.
-  PUT(HEADER_PTR(bp), PACK(size, 0));               // free block header
-  PUT(FOOTER_PTR(bp), PACK(size, 0));               // free block footer
-  PUT(HEADER_PTR(NEXT_BLOCK_PTR(bp)), PACK(0, 1));  // new epilogue header
+  // 기존 에필로그 헤더가 새 블럭의 헤더가 되므로 prev_alloc 비트를 물려받는다.
+  size_t prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
+  PUT(HEADER_PTR(bp), PACK(size, prev_alloc, 0));      // free block header
+  PUT(FOOTER_PTR(bp), PACK(size, prev_alloc, 0));      // free block footer
+  PUT(HEADER_PTR(NEXT_BLOCK_PTR(bp)), PACK(0, 0, 1));  // new epilogue header
 
   // 기존 블럭이 해제되었더라면 병합해주어야지
-  return coalesce(bp);
+  return coalesce(a, bp);
+}
+
+/**
+ * @brief bp가 힙의 마지막 블럭이고 TRIM_THRESHOLD보다 크면 TRIM_PAD만 남기고
+ * 나머지를 시스템에 돌려준다. 다음 성장에 다시 페이지를 받아오는 비용을
+ * 줄이기 위해 두 값 사이에 여유를 둔다.
+ *
+ * bp는 free list에 들어있는 free block이다. 줄어든 블럭은 다시 free list에
+ * 넣고, 그 뒤에 에필로그 헤더를 새로 단다.
+ */
+void trim_heap(arena_t *a, void *bp) {
+  size_t size = GET_SIZE(HEADER_PTR(bp));
+  size_t prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
+
+  if (size < TRIM_THRESHOLD || !is_epilogue(NEXT_BLOCK_PTR(bp))) {
+    return;
+  }
+  size_t release = (size - TRIM_PAD) & ~(size_t)(CHUNKSIZE - 1);
+
+  remove_free_block(a, bp);
+  if (mem_sbrk_at(a->heap, -(int)release) != (void *)-1) {
+    size -= release;
+    PUT(HEADER_PTR(bp), PACK(size, prev_alloc, 0));
+    PUT(FOOTER_PTR(bp), PACK(size, prev_alloc, 0));
+    PUT(HEADER_PTR(NEXT_BLOCK_PTR(bp)), PACK(0, 0, 1));  // new epilogue header
+    mem_trim_at(a->heap);
+  }
+  insert_free_block(a, bp);
 }
 
 /**
@@ -246,141 +983,725 @@ void *extend_heap(size_t words) {
  * - next is freed
  * - prev & next is freed
  *
+ * 병합 대상인 이웃 free block은 free list에서 먼저 빼내고, 병합이 끝난
+ * 블럭을 알맞은 size class에 넣는다. 이전 블럭의 할당 여부는 내 헤더의
+ * prev_alloc 비트로 판단하고, 이전 블럭이 free일 때만 그 푸터를 읽는다.
+ * 인접한 free block은 항상 병합되므로 결과 블럭의 이전 블럭은 할당 상태이다.
+ *
  * @return coalesced block pointer
  */
-void *coalesce(byte_p bp) {
-  byte_p prev_bp = PREV_BLOCK_PTR(bp);
+void *coalesce(arena_t *a, byte_p bp) {
   byte_p next_bp = NEXT_BLOCK_PTR(bp);
+  bool prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
+  bool next_alloc = GET_ALLOC(HEADER_PTR(next_bp));
+  size_t size = GET_SIZE(HEADER_PTR(bp));
 
-  if (GET_ALLOC(HEADER_PTR(prev_bp)) && GET_ALLOC(HEADER_PTR(next_bp))) {
-    // none is freed, do nothing?
-    return bp;
-  }
-  if (!GET_ALLOC(HEADER_PTR(prev_bp)) && GET_ALLOC(HEADER_PTR(next_bp))) {
+  if (prev_alloc && next_alloc) {
+    // none is freed, 나만 free list에 넣는다.
+  } else if (!prev_alloc && next_alloc) {
     // prev is freed, prev의 헤더와 내 푸터의 값을 바꾼다.
-    size_t extended_blocksize =
-        GET_SIZE(HEADER_PTR(bp)) + GET_SIZE(HEADER_PTR(prev_bp));
-    size_t packed = PACK(extended_blocksize, 0);
+    byte_p prev_bp = PREV_BLOCK_PTR(bp);
+    remove_free_block(a, prev_bp);
+    size += GET_SIZE(HEADER_PTR(prev_bp));
+    PUT(HEADER_PTR(prev_bp), PACK(size, 1, 0));
+    PUT(FOOTER_PTR(prev_bp), PACK(size, 1, 0));
+    bp = prev_bp;
+  } else if (prev_alloc && !next_alloc) {
+    // next is freed, 내 헤더와 next의 푸터의 값을 바꾼다.
+    remove_free_block(a, next_bp);
+    size += GET_SIZE(HEADER_PTR(next_bp));
+    PUT(HEADER_PTR(bp), PACK(size, 1, 0));
+    PUT(FOOTER_PTR(bp), PACK(size, 1, 0));
+  } else {
+    // prev, next is freed, prev의 헤더와 next의 푸터의 값을 바꾼다.
+    byte_p prev_bp = PREV_BLOCK_PTR(bp);
+    remove_free_block(a, prev_bp);
+    remove_free_block(a, next_bp);
+    size += GET_SIZE(HEADER_PTR(prev_bp)) + GET_SIZE(HEADER_PTR(next_bp));
+    PUT(HEADER_PTR(prev_bp), PACK(size, 1, 0));
+    PUT(FOOTER_PTR(prev_bp), PACK(size, 1, 0));
+    bp = prev_bp;
+  }
 
-    PUT(HEADER_PTR(prev_bp), packed);
-    PUT(FOOTER_PTR(bp), packed);
+  // 병합된 블럭의 다음 블럭에게 내가 free임을 알린다.
+  CLEAR_PREV_ALLOC(NEXT_BLOCK_PTR(bp));
+  insert_free_block(a, bp);
+  return bp;
+}
 
-    g_cur = prev_bp;
-    return prev_bp;
+/**
+ * @brief find_fit - asize가 속한 size class부터 큰 class 순으로 탐색한다.
+ *
+ * asize가 속한 class에는 asize보다 작은 블럭도 섞여 있으므로 리스트를 훑어야
+ * 하지만, 그보다 큰 class의 블럭은 모두 asize를 담을 수 있다. SEG_BEST_FIT이
+ * 켜져 있으면 처음으로 찾은 class 안에서 가장 딱 맞는 블럭을 고른다.
+ * 리스트에 맞는 블럭이 없으면 best fit tree에서 찾는다.
+ *
+ * @return asize <= BLOCK_SIZE를 만족하는 블럭 포인터 | NULL
+ */
+void *find_fit(arena_t *a, size_t asize) {
+  if (asize >= TREE_MIN_SIZE) {
+    return find_tree(a, asize);
   }
 
-  if (!GET_ALLOC(HEADER_PTR(next_bp)) && GET_ALLOC(HEADER_PTR(prev_bp))) {
-    // next is freed, 내 헤더와 next의 푸터의 값을 바꾼다.
-    size_t extended_blocksize =
-        GET_SIZE(HEADER_PTR(bp)) + GET_SIZE(HEADER_PTR(next_bp));
-    dword_t packed = PACK(extended_blocksize, 0);
-
-    PUT(HEADER_PTR(bp), packed);
-    PUT(FOOTER_PTR(next_bp), packed);
+  for (int i = size_class(asize); i < NUM_CLASSES; i++) {
+    void *fit = NULL;
+    size_t fit_size = 0;
 
-    g_cur = bp;
-    return bp;
+    for (void *cur = a->seg_list[i]; cur != NULL; cur = SUCC(cur)) {
+      size_t cur_size = GET_SIZE(HEADER_PTR(cur));
+      if (cur_size < asize) {
+        continue;
+      }
+      if (!SEG_BEST_FIT || cur_size == asize) {
+        return cur;
+      }
+      if (fit == NULL || cur_size < fit_size) {
+        fit = cur;
+        fit_size = cur_size;
+      }
+    }
+    if (fit != NULL) {
+      return fit;
+    }
   }
+  return find_tree(a, asize);
+}
 
-  // prev, next is freed, prev의 헤더와 next의 푸터의 값을 바꾼다.
-  size_t extended_blocksize = GET_SIZE(HEADER_PTR(prev_bp)) +
-                              GET_SIZE(HEADER_PTR(bp)) +
-                              GET_SIZE(HEADER_PTR(next_bp));
-  size_t packed = PACK(extended_blocksize, 0);
+/**
+ * @brief 일반 free block 중에 맞는 블럭이 없을 때, 힙을 늘리기 전에
+ * realloc reserve block을 빼앗아 쓴다.
+ */
+void *find_reserve(arena_t *a, size_t asize) {
+  for (void *cur = a->reserve_list; cur != NULL; cur = SUCC(cur)) {
+    if (asize <= GET_SIZE(HEADER_PTR(cur))) {
+      return cur;
+    }
+  }
+  return NULL;
+}
 
-  PUT(HEADER_PTR(prev_bp), packed);
-  PUT(FOOTER_PTR(next_bp), packed);
+/**
+ * @brief 할당된 블럭 bp를 free 상태로 바꾸고 인접 free block과 병합한다.
+ */
+void free_block(arena_t *a, void *bp) {
+  size_t size = GET_SIZE(HEADER_PTR(bp));
+  size_t prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
 
-  g_cur = prev_bp;
-  return prev_bp;
+  PUT(HEADER_PTR(bp), PACK(size, prev_alloc, 0));
+  PUT(FOOTER_PTR(bp), PACK(size, prev_alloc, 0));
+  trim_heap(a, coalesce(a, bp));
 }
 
 /**
- * @brief find_fit - first fit을 기준으로 찾아라
- *
- * @return asize <= BLOCK_SIZE - 2WSIZE를 만족하는 블럭 포인터 | NULL
+ * @brief 할당 상태 그대로 quick list의 맨 앞에 넣는다. 리스트가 가득 차
+ * 있으면 먼저 비운다. realloc 태그는 새 주인에게 물려주지 않는다.
  */
-void *find_fit(size_t asize) { return next_fit(asize); }
+void push_quick(arena_t *a, void *bp, size_t size) {
+  int i = QUICK_INDEX(size);
 
-void *first_fit(size_t asize) {
-  for (void *cur = g_heap_listp; GET_SIZE(HEADER_PTR(cur)) > 0;
-       cur = NEXT_BLOCK_PTR(cur)) {
-    if (!GET_ALLOC(HEADER_PTR(cur)) && (asize <= GET_SIZE(HEADER_PTR(cur)))) {
-      return cur;
-    }
+  if (a->quick_count[i] == QUICK_MAX_COUNT) {
+    flush_quick(a, i);
   }
+  PUT(HEADER_PTR(bp), GET(HEADER_PTR(bp)) & ~0x04);
+  NEXT_QUICK(bp) = a->quick[i];
+  a->quick[i] = TO_LINK(bp);
+  a->quick_count[i]++;
+  a->quick_bytes += size;
+}
 
-  return NULL;
+void *pop_quick(arena_t *a, int i) {
+  void *bp = FROM_LINK(a->quick[i]);
+
+  a->quick[i] = NEXT_QUICK(bp);
+  a->quick_count[i]--;
+  a->quick_bytes -= GET_SIZE(HEADER_PTR(bp));
+  return bp;
 }
 
-void *next_fit(size_t asize) {
-  // g_cur -> epilogue
-  for (void *cur = g_cur; GET_SIZE(HEADER_PTR(cur)) > 0;
-       cur = NEXT_BLOCK_PTR(cur)) {
-    void *p = HEADER_PTR(cur);
-    if (!GET_ALLOC(p) && asize <= GET_SIZE(p)) {
-      g_cur = cur;
-      return cur;
-    }
+/**
+ * @brief quick list i의 블럭을 모두 free 하여 병합한다.
+ */
+void flush_quick(arena_t *a, int i) {
+  while (a->quick[i] != 0) {
+    free_block(a, pop_quick(a, i));
   }
+}
 
-  // prologue -> g_cur
-  for (void *cur = g_heap_listp; cur < g_cur; cur = NEXT_BLOCK_PTR(cur)) {
-    void *p = HEADER_PTR(cur);
-    if (!GET_ALLOC(p) && asize <= GET_SIZE(p)) {
-      g_cur = cur;
-      return cur;
-    }
+/**
+ * @brief fit 탐색이 실패했을 때 모든 quick list를 비운다.
+ *
+ * 모아둔 블럭을 다 합쳐도 asize보다 작으면 병합으로 맞는 블럭이 생길
+ * 가능성이 낮으므로 비우지 않는다.
+ *
+ * @return 비운 블럭이 하나라도 있었는지
+ */
+bool flush_all_quick(arena_t *a, size_t asize) {
+  if (a->quick_bytes == 0 || a->quick_bytes < asize) {
+    return false;
   }
-  return NULL;
+  for (int i = 0; i < NUM_QUICK_LISTS; i++) {
+    flush_quick(a, i);
+  }
+  return true;
+}
+
+/**
+ * @brief size 바이트 payload를 담을 영역을 힙 밖에 새로 매핑한다.
+ *
+ * @return payload 포인터 | NULL
+ */
+void *map_block(size_t size) {
+  size_t map_size = size + DSIZE;
+  byte_p region = mem_map(map_size);
+
+  if (region == (void *)-1) {
+    return NULL;
+  }
+  *(size_t *)region = map_size;
+  return region + DSIZE;
+}
+
+/**
+ * @brief 매핑된 블럭의 영역 크기를 바꾼다. 영역이 옮겨져도 내용은 유지된다.
+ *
+ * @return 새 payload 포인터 | NULL (기존 블럭은 그대로)
+ */
+void *remap_block(void *bp, size_t size) {
+  size_t map_size = size + DSIZE;
+  byte_p region = mem_remap((byte_p)bp - DSIZE, MAP_SIZE(bp), map_size);
+
+  if (region == (void *)-1) {
+    return NULL;
+  }
+  *(size_t *)region = map_size;
+  return region + DSIZE;
 }
 
 /**
  * @brief place requested block at the beginning of the free block
  *
  * find_fit, extend_heap의 리턴값은 `asize`가 들어갈 공간이 주어진 블럭의
- * 주소값이다. 우리가 할 건 bp에 헤더와 푸터를 달고 쪼개진 free block에 헤더와
- * 푸터를 다는 것이다.
+ * 주소값이다. 우리가 할 건 bp를 free list에서 빼고 헤더를 단 뒤, 쪼개진
+ * free block에 헤더와 푸터를 달아 다시 free list에 넣는 것이다. free block의
+ * 이전 블럭은 항상 할당 상태이므로 prev_alloc 비트는 1이다.
  */
-void place(void *bp, size_t asize) {
+void place(arena_t *a, void *bp, size_t asize) {
   size_t old_size = GET_SIZE(HEADER_PTR(bp));
   size_t free_size = old_size - asize;
-  dword_t pack_alloc = PACK(asize, 1);  // 새로이 할당한 블럭의 헤더/푸터 값
-  dword_t pack_free = PACK(free_size, 0);  // 쪼개진 블럭의 헤더/푸터 값
+  dword_t pack_alloc = PACK(asize, 1, 1);  // 새로이 할당한 블럭의 헤더 값
+  dword_t pack_free = PACK(free_size, 1, 0);  // 쪼개진 블럭의 헤더/푸터 값
+
+  remove_free_block(a, bp);
 
   // set header and footer for splitted block
   // minimum block size <= asize
   if (MINIMUM_BLOCK_SIZE <= free_size) {
-    // set header and footer for my block
+    // set header for my block
     PUT(HEADER_PTR(bp), pack_alloc);
-    PUT(FOOTER_PTR(bp), pack_alloc);
     // set header and footer for free block
     byte_p splitted_bp = NEXT_BLOCK_PTR(bp);
     PUT(HEADER_PTR(splitted_bp), pack_free);
     PUT(FOOTER_PTR(splitted_bp), pack_free);
+    insert_free_block(a, splitted_bp);
   } else {
     // intentional internal fragmentation with padding bytes
-    dword_t pack_all = PACK(old_size, 1);
-    PUT(HEADER_PTR(bp), pack_all);
-    PUT(FOOTER_PTR(bp), pack_all);
+    PUT(HEADER_PTR(bp), PACK(old_size, 1, 1));
+    SET_PREV_ALLOC(NEXT_BLOCK_PTR(bp));
   }
+}
 
-  g_cur = bp;
+/**
+ * @brief 할당된 블럭 bp를 asize로 줄이고 남는 뒷부분을 free block으로 만든다.
+ *
+ * 남는 부분이 최소 블럭 크기보다 작으면 padding으로 그대로 둔다. 떼어낸
+ * 블럭은 다음 free block과 병합되어 free list에 들어간다.
+ *
+ * @return 떼어내 병합된 free block | NULL
+ */
+void *trim_block(arena_t *a, void *bp, size_t asize) {
+  void *hp = HEADER_PTR(bp);
+  size_t size = GET_SIZE(hp);
+  size_t free_size = size - asize;
+
+  if (free_size < MINIMUM_BLOCK_SIZE) {
+    return NULL;
+  }
+  PUT(hp, PACK(asize, GET_PREV_ALLOC(hp), 1) | GET_TAG(hp));
+  byte_p splitted_bp = NEXT_BLOCK_PTR(bp);
+  PUT(HEADER_PTR(splitted_bp), PACK(free_size, 1, 0));
+  PUT(FOOTER_PTR(splitted_bp), PACK(free_size, 1, 0));
+  return coalesce(a, splitted_bp);
 }
 
 /**
- * @brief size that can cover additional DWORDs, align 8-byte
+ * @brief realloc으로 늘어난 블럭에 태그를 달고 asize 뒤에 남는 공간을
+ * 떼어낸다. reserve가 참이면 떼어낸 공간을 reserve block으로 남긴다.
+ *
+ * 떼어낸 공간은 다음 free block과 병합된 것이므로, reserve 크기보다 최소
+ * 블럭 이상 크면 일반 free list에 그대로 둔다. reserve list는 일반 탐색에서
+ * 빠지므로 큰 free block이 그곳에 묻히면 안 된다.
  */
-inline size_t adjust_size(size_t size) {
-  size_t asize;
-  if (size <= DSIZE) {
-    asize = 2 * DSIZE;  // for header and footer
+void *finish_grow(arena_t *a, void *bp, size_t asize, bool reserve) {
+  void *rest = trim_block(a, bp, asize);
+
+  SET_TAG(bp);
+  if (reserve && rest != NULL &&
+      GET_SIZE(HEADER_PTR(rest)) < RESERVE_SIZE(asize) + MINIMUM_BLOCK_SIZE) {
+    remove_free_block(a, rest);
+    insert_reserve(a, rest);
+  }
+  return bp;
+}
+
+/**
+ * @brief realloc이 옮겨갈 새 블럭 bp를 뒤따르는 free block과 합치고, 그
+ * 영역을 [free block][asize 블럭][reserve block]으로 나눈다.
+ *
+ * reserve를 영역의 끝에 두면 그 뒤는 할당된 블럭이므로, 인접한 free block은
+ * 항상 병합되어 있다는 규칙을 지키면서 reserve를 RESERVE_SIZE(asize)로
+ * 떼어낼 수 있다. 앞에 남는 공간은 병합하여 일반 free list로 돌려주고,
+ * 최소 블럭 크기보다 작으면 reserve에 붙인다.
+ *
+ * @return 태그를 단 asize 블럭
+ */
+void *place_grow(arena_t *a, void *bp, size_t asize) {
+  size_t prev_alloc = GET_PREV_ALLOC(HEADER_PTR(bp));
+  size_t size = GET_SIZE(HEADER_PTR(bp));
+  size_t tail = asize + RESERVE_SIZE(asize);
+  void *next_bp = NEXT_BLOCK_PTR(bp);
+
+  if (!GET_ALLOC(HEADER_PTR(next_bp))) {
+    remove_free_block(a, next_bp);
+    size += GET_SIZE(HEADER_PTR(next_bp));
+  }
+  size_t front = size >= tail + MINIMUM_BLOCK_SIZE ? size - tail : 0;
+  size_t rest = size - front - asize;
+  byte_p new_bp = (byte_p)bp + front;
+
+  if (rest < MINIMUM_BLOCK_SIZE) {
+    // reserve를 둘 자리가 없으면 padding으로 둔다.
+    PUT(HEADER_PTR(new_bp), PACK(size, prev_alloc, 1));
+    SET_PREV_ALLOC(NEXT_BLOCK_PTR(new_bp));
+  } else {
+    PUT(HEADER_PTR(new_bp), PACK(asize, front > 0 ? 0 : prev_alloc, 1));
+    byte_p reserve_bp = NEXT_BLOCK_PTR(new_bp);
+    PUT(HEADER_PTR(reserve_bp), PACK(rest, 1, 0));
+    PUT(FOOTER_PTR(reserve_bp), PACK(rest, 1, 0));
+    insert_reserve(a, reserve_bp);
+    CLEAR_PREV_ALLOC(NEXT_BLOCK_PTR(reserve_bp));
+  }
+  SET_TAG(new_bp);
+
+  if (front > 0) {
+    PUT(HEADER_PTR(bp), PACK(front, prev_alloc, 0));
+    PUT(FOOTER_PTR(bp), PACK(front, prev_alloc, 0));
+    coalesce(a, bp);
+  }
+  return new_bp;
+}
+
+/**
+ * @brief free block에 태그를 달아 reserve list의 맨 앞에 넣는다.
+ */
+void insert_reserve(arena_t *a, void *bp) {
+  SET_TAG(bp);
+  SET_PRED(bp, NULL);
+  SET_SUCC(bp, a->reserve_list);
+  if (a->reserve_list != NULL) {
+    SET_PRED(a->reserve_list, bp);
+  }
+  a->reserve_list = bp;
+}
+
+/**
+ * @brief free block을 크기에 맞는 class 리스트의 맨 앞(LIFO)이나 best fit
+ * tree에 넣는다.
+ */
+void insert_free_block(arena_t *a, void *bp) {
+  size_t size = GET_SIZE(HEADER_PTR(bp));
+  if (size >= TREE_MIN_SIZE) {
+    insert_tree(a, bp);
+    return;
+  }
+
+  int i = size_class(size);
+
+  SET_PRED(bp, NULL);
+  SET_SUCC(bp, a->seg_list[i]);
+  if (a->seg_list[i] != NULL) {
+    SET_PRED(a->seg_list[i], bp);
+  }
+  a->seg_list[i] = bp;
+}
+
+/**
+ * @brief free block을 자신이 속한 class 리스트나 best fit tree, reserve
+ * list에서 떼어낸다.
+ */
+void remove_free_block(arena_t *a, void *bp) {
+  size_t size = GET_SIZE(HEADER_PTR(bp));
+  if (GET_TAG(HEADER_PTR(bp))) {
+    void *pred = PRED(bp);
+    void *succ = SUCC(bp);
+
+    if (pred != NULL) {
+      LINK(pred, 1) = LINK(bp, 1);
+    } else {
+      a->reserve_list = succ;
+    }
+    if (succ != NULL) {
+      LINK(succ, 0) = LINK(bp, 0);
+    }
+    PUT(HEADER_PTR(bp), GET(HEADER_PTR(bp)) & ~0x04);
+    return;
+  }
+  if (size >= TREE_MIN_SIZE) {
+    remove_tree(a, bp);
+    return;
+  }
+
+  void *pred = PRED(bp);
+  void *succ = SUCC(bp);
+
+  if (pred != NULL) {
+    LINK(pred, 1) = LINK(bp, 1);
+  } else {
+    a->seg_list[size_class(size)] = succ;
+  }
+  if (succ != NULL) {
+    LINK(succ, 0) = LINK(bp, 0);
+  }
+}
+
+/**
+ * @brief free block을 best fit tree에 넣는다.
+ *
+ * 같은 크기의 노드가 있으면 그 체인에 매단다. 없으면 bp보다 우선순위가 낮은
+ * 첫 노드 자리에서 그 서브트리를 bp의 크기로 쪼개 양쪽 자식으로 삼는다.
+ */
+void insert_tree(arena_t *a, void *bp) {
+  size_t size = NODE_SIZE(bp);
+  unsigned int prio = TREE_PRIO(size);
+  link_t *link = &a->tree_root;
+  void *node;
+
+  SET_PRED(bp, NULL);
+  SET_SUCC(bp, NULL);
+  for (node = FROM_LINK(a->tree_root); node != NULL;) {
+    size_t node_size = NODE_SIZE(node);
+    if (size == node_size) {
+      // same size chain, 트리 노드 바로 뒤에 매단다.
+      void *succ = SUCC(node);
+      SET_PRED(bp, node);
+      SET_SUCC(bp, succ);
+      if (succ != NULL) {
+        SET_PRED(succ, bp);
+      }
+      SET_SUCC(node, bp);
+      return;
+    }
+    node = size < node_size ? LEFT(node) : RIGHT(node);
+  }
+
+  while ((node = FROM_LINK(*link)) != NULL &&
+         TREE_PRIO(NODE_SIZE(node)) >= prio) {
+    link = size < NODE_SIZE(node) ? &LEFT_LINK(node) : &RIGHT_LINK(node);
+  }
+  *link = TO_LINK(bp);
+
+  // split: node 서브트리를 size보다 작은 쪽과 큰 쪽으로 나눈다.
+  link_t *lp = &LEFT_LINK(bp);
+  link_t *rp = &RIGHT_LINK(bp);
+  while (node != NULL) {
+    if (NODE_SIZE(node) < size) {
+      *lp = TO_LINK(node);
+      lp = &RIGHT_LINK(node);
+      node = RIGHT(node);
+    } else {
+      *rp = TO_LINK(node);
+      rp = &LEFT_LINK(node);
+      node = LEFT(node);
+    }
+  }
+  *lp = *rp = 0;
+}
+
+/**
+ * @brief free block을 best fit tree에서 떼어낸다.
+ *
+ * 체인 중간의 블럭은 체인에서만 빼면 된다. 트리 노드가 빠질 때 체인이
+ * 남아있으면 다음 블럭이 그 자리를 그대로 물려받고 (우선순위는 크기로
+ * 정해지므로 바뀌지 않는다), 아니면 두 자식 서브트리를 합친다.
+ */
+void remove_tree(arena_t *a, void *bp) {
+  void *pred = PRED(bp);
+  void *next = SUCC(bp);
+
+  if (pred != NULL) {
+    LINK(pred, 1) = LINK(bp, 1);
+    if (next != NULL) {
+      LINK(next, 0) = LINK(bp, 0);
+    }
+    return;
+  }
+
+  size_t size = NODE_SIZE(bp);
+  link_t self = TO_LINK(bp);
+  link_t *link = &a->tree_root;
+  while (*link != self) {
+    void *node = FROM_LINK(*link);
+    link = size < NODE_SIZE(node) ? &LEFT_LINK(node) : &RIGHT_LINK(node);
+  }
+
+  if (next != NULL) {
+    SET_PRED(next, NULL);
+    LEFT_LINK(next) = LEFT_LINK(bp);
+    RIGHT_LINK(next) = RIGHT_LINK(bp);
+    *link = TO_LINK(next);
+    return;
+  }
+
+  // join: 왼쪽 서브트리의 키는 모두 오른쪽보다 작다.
+  void *l = LEFT(bp);
+  void *r = RIGHT(bp);
+  while (l != NULL && r != NULL) {
+    if (TREE_PRIO(NODE_SIZE(l)) > TREE_PRIO(NODE_SIZE(r))) {
+      *link = TO_LINK(l);
+      link = &RIGHT_LINK(l);
+      l = RIGHT(l);
+    } else {
+      *link = TO_LINK(r);
+      link = &LEFT_LINK(r);
+      r = LEFT(r);
+    }
+  }
+  *link = TO_LINK(l != NULL ? l : r);
+}
+
+/**
+ * @brief asize 이상인 블럭 중 가장 작은 블럭을 찾는다.
+ *
+ * 트리를 바꾸지 않고 내려가면서 asize 이상인 노드 중 가장 작은 것을 기억한다.
+ * 체인이 있으면 트리 구조를 건드리지 않도록 체인의 블럭을 돌려준다.
+ *
+ * @return best fit 블럭 포인터 | NULL
+ */
+void *find_tree(arena_t *a, size_t asize) {
+  void *fit = NULL;
+
+  for (void *node = FROM_LINK(a->tree_root); node != NULL;) {
+    size_t node_size = NODE_SIZE(node);
+    if (node_size == asize) {
+      fit = node;
+      break;
+    }
+    if (node_size > asize) {
+      fit = node;
+      node = LEFT(node);
+    } else {
+      node = RIGHT(node);
+    }
+  }
+  if (fit == NULL) {
+    return NULL;
+  }
+  return SUCC(fit) != NULL ? SUCC(fit) : fit;
+}
+
+/**
+ * @brief slab class의 run에서 slot 하나를 꺼낸다.
+ *
+ * 반납된 slot이 있으면 먼저 쓰고, 없으면 아직 나눠주지 않은 영역에서 slot을
+ * 잘라낸다. run이 가득 차면 class 리스트에서 뺀다.
+ */
+void *slab_malloc(arena_t *a, int cls) {
+  run_t *run = a->runs[cls];
+  void *slot;
+
+  if (run == NULL && (run = new_run(a, cls)) == NULL) {
+    return NULL;
+  }
+
+  if (run->free_slot != NULL) {
+    slot = run->free_slot;
+    run->free_slot = *(void **)slot;
+  } else {
+    slot = run->unused;
+    run->unused += run->slot_size;
+  }
+  run->nused++;
+
+  if (RUN_FULL(run)) {
+    a->runs[cls] = run->next;
+    if (run->next != NULL) {
+      run->next->prev = NULL;
+    }
+    run->next = NULL;
+  }
+  return slot;
+}
+
+/**
+ * @brief slot을 run에 반납한다.
+ *
+ * 가득 찼던 run은 다시 class 리스트에 넣는다. 비어버린 run은 그 class의 유일한
+ * run이 아니라면 일반 힙 블럭으로 돌려보낸다.
+ */
+void slab_free(arena_t *a, void *p, void *ptr) {
+  run_t *run = p;
+  int cls = run->cls;
+
+  if (RUN_FULL(run)) {
+    run->prev = NULL;
+    run->next = a->runs[cls];
+    if (a->runs[cls] != NULL) {
+      a->runs[cls]->prev = run;
+    }
+    a->runs[cls] = run;
+  }
+
+  *(void **)ptr = run->free_slot;
+  run->free_slot = ptr;
+  run->nused--;
+
+  if (run->nused == 0 && (run->prev != NULL || run->next != NULL)) {
+    if (run->prev != NULL) {
+      run->prev->next = run->next;
+    } else {
+      a->runs[cls] = run->next;
+    }
+    if (run->next != NULL) {
+      run->next->prev = run->prev;
+    }
+    set_run(run, false);
+    free_block(a, run);
+  }
+}
+
+/**
+ * @brief 새 run을 만들어 class 리스트에 넣는다.
+ */
+void *new_run(arena_t *a, int cls) {
+  run_t *run = carve_run(a);
+
+  if (run == NULL) {
+    return NULL;
+  }
+  run->prev = NULL;
+  run->next = a->runs[cls];
+  if (a->runs[cls] != NULL) {
+    a->runs[cls]->prev = run;
+  }
+  a->runs[cls] = run;
+  run->free_slot = NULL;
+  run->unused = (byte_p)run + RUN_HEADER_SIZE;
+  run->slot_size = (cls + 1) * DSIZE;
+  run->nused = 0;
+  run->cls = cls;
+  set_run(run, true);
+  return run;
+}
+
+/**
+ * @brief 힙 끝에서 RUN_SIZE로 정렬된 RUN_SIZE 크기의 할당 블럭을 잘라낸다.
+ *
+ * 힙의 마지막 블럭이 free라면 그 블럭부터, 아니면 에필로그 자리부터 정렬된
+ * 주소를 찾고 모자란 만큼만 힙을 늘린다. run 앞뒤로 남는 공간은 free block이
+ * 되어 일반 요청에 쓰인다.
+ */
+void *carve_run(arena_t *a) {
+  byte_p epilogue = (byte_p)mem_heap_hi_at(a->heap) + 1;
+  byte_p start = GET_PREV_ALLOC(HEADER_PTR(epilogue)) ? epilogue
+                                                      : PREV_BLOCK_PTR(epilogue);
+  byte_p run = (byte_p)RUN_OF(start + RUN_SIZE - 1);
+  if (run != start && (size_t)(run - start) < MINIMUM_BLOCK_SIZE) {
+    run += RUN_SIZE;
+  }
+
+  // run 뒤에 남는 공간은 없거나 최소 블럭 크기 이상이어야 한다.
+  byte_p end = run + RUN_SIZE;
+  if (end > epilogue) {
+    if (extend_heap(a, (end - epilogue) / WSIZE) == NULL) {
+      return NULL;
+    }
+  } else if (end < epilogue && (size_t)(epilogue - end) < MINIMUM_BLOCK_SIZE) {
+    if (extend_heap(a, MINIMUM_BLOCK_SIZE / WSIZE) == NULL) {
+      return NULL;
+    }
+  }
+
+  // start부터 시작하는 free block을 [front][run][back]으로 나눈다.
+  size_t size = GET_SIZE(HEADER_PTR(start));
+  size_t front = run - start;
+  size_t back = size - front - RUN_SIZE;
+
+  remove_free_block(a, start);
+  if (front > 0) {
+    PUT(HEADER_PTR(start), PACK(front, 1, 0));
+    PUT(FOOTER_PTR(start), PACK(front, 1, 0));
+    insert_free_block(a, start);
+  }
+  PUT(HEADER_PTR(run), PACK(RUN_SIZE, front == 0, 1));
+  if (back > 0) {
+    byte_p back_bp = NEXT_BLOCK_PTR(run);
+    PUT(HEADER_PTR(back_bp), PACK(back, 1, 0));
+    PUT(FOOTER_PTR(back_bp), PACK(back, 1, 0));
+    insert_free_block(a, back_bp);
+  } else {
+    SET_PREV_ALLOC(NEXT_BLOCK_PTR(run));
+  }
+  return run;
+}
+
+/**
+ * @brief run 후보 주소가 실제 slab run인지 g_run_map에서 확인한다.
+ *
+ * thread cache는 lock 없이 비트맵을 읽으므로 atomic으로 읽고 쓴다.
+ */
+inline bool is_run(void *run) {
+  size_t page = ((byte_p)run - g_run_base) / RUN_SIZE;
+  return (byte_p)run >= g_run_base && page < RUN_MAP_BYTES * 8 &&
+         (__atomic_load_n(&g_run_map[page / 8], __ATOMIC_RELAXED) >>
+          (page % 8)) & 1;
+}
+
+inline void set_run(void *run, bool on) {
+  size_t page = ((byte_p)run - g_run_base) / RUN_SIZE;
+  if (on) {
+    __atomic_fetch_or(&g_run_map[page / 8], 1 << (page % 8),
+                      __ATOMIC_RELAXED);
   } else {
-    // size + header + footer + padding 포함한 DSIZE 기준으로 정렬된 블럭의 크기
-    // (bytes)
-    asize = DSIZE * ((size + (DSIZE) + (DSIZE - 1)) / DSIZE);
+    __atomic_fetch_and(&g_run_map[page / 8], ~(1 << (page % 8)),
+                       __ATOMIC_RELAXED);
+  }
+}
+
+/**
+ * @brief 블럭 크기가 속하는 size class의 인덱스
+ *
+ * class i는 [2^(i + MIN_CLASS_SHIFT), 2^(i + MIN_CLASS_SHIFT + 1)) 범위의
+ * 블럭을 담고, 마지막 class는 그 이상의 모든 블럭을 담는다.
+ */
+inline int size_class(size_t size) {
+  int msb = (int)(sizeof(unsigned long) * 8 - 1) - __builtin_clzl(size);
+  int i = msb - MIN_CLASS_SHIFT;
+
+  if (i < 0) {
+    return 0;
   }
-  return asize;
+  return i < NUM_CLASSES ? i : NUM_CLASSES - 1;
+}
+
+/**
+ * @brief size that can cover an additional header WORD, align 8-byte
+ */
+inline size_t adjust_size(size_t size) {
+  // size + header 포함한 DSIZE 기준으로 정렬된 블럭의 크기 (bytes)
+  // free 될 때 footer와 free list 포인터를 담을 수 있도록 최소 블럭 크기를
+  // 보장한다.
+  size_t asize = ALIGN(size + WSIZE);
+  return MAX(asize, MINIMUM_BLOCK_SIZE);
 }
 
 inline bool is_prologue(void *bp) {
@@ -392,5 +1713,5 @@ inline bool is_epilogue(void *bp) {
 }
 
 dword_t __offset(void *p) {
-  return (dword_t)((byte_p)p - (byte_p)g_heap_listp);
+  return (dword_t)((byte_p)p - g_heap_base);
 }
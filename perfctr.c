@@ -0,0 +1,125 @@
+/*
+ * perfctr.c - Hardware performance counters for mdriver -P (see perfctr.h)
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "perfctr.h"
+
+char *perfctr_names[PERFCTR_NUM] = {
+    "cycles", "instrs", "L1d-miss", "LLC-miss", "br-miss", "dTLB-miss"
+};
+
+/* perf_event_attr type and config of each event */
+#define CACHE_MISS(cache) \
+    ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+     (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+static struct {
+    unsigned type;
+    unsigned long long config;
+} events[PERFCTR_NUM] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)},
+};
+
+/*
+ * perfctr_open - open a disabled counter for every event this thread
+ *     may count. Returns the number of events that could be opened.
+ */
+int perfctr_open(perfctr_t *pc)
+{
+    struct perf_event_attr attr;
+    int i, n = 0;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = events[i].type;
+	attr.config = events[i].config;
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+	    PERF_FORMAT_TOTAL_TIME_RUNNING;
+	pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+	if (pc->fd[i] >= 0)
+	    n++;
+	else
+	    pc->fd[i] = -1;
+    }
+    return n;
+}
+
+/*
+ * perfctr_start - start counting. RESET would zero only the value, while
+ *     the times enabled and running add up over the whole life of a
+ *     counter, so all three are saved here and perfctr_stop uses the
+ *     differences.
+ */
+void perfctr_start(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	if (pc->fd[i] < 0)
+	    continue;
+	if (read(pc->fd[i], pc->start[i], sizeof(pc->start[i])) !=
+	    sizeof(pc->start[i]))
+	    memset(pc->start[i], 0, sizeof(pc->start[i]));
+	ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+/*
+ * perfctr_stop - stop counting and store the counts since perfctr_start
+ *     in vals, scaled by the part of that interval each event was on a
+ *     hardware counter. An event that never got one is not valid.
+ */
+void perfctr_stop(perfctr_t *pc, perfctr_vals_t *vals)
+{
+    uint64_t buf[3]; /* value, time enabled, time running */
+    uint64_t count, enabled, running;
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++)
+	if (pc->fd[i] >= 0)
+	    ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	vals->valid[i] = 0;
+	vals->count[i] = 0;
+	if (pc->fd[i] < 0 || read(pc->fd[i], buf, sizeof(buf)) != sizeof(buf))
+	    continue;
+	count = buf[0] - pc->start[i][0];
+	enabled = buf[1] - pc->start[i][1];
+	running = buf[2] - pc->start[i][2];
+	if (running == 0)
+	    continue;
+	vals->valid[i] = 1;
+	vals->count[i] = (double)count * ((double)enabled / running);
+    }
+}
+
+/*
+ * perfctr_close - close the counters
+ */
+void perfctr_close(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERFCTR_NUM; i++) {
+	if (pc->fd[i] >= 0)
+	    close(pc->fd[i]);
+	pc->fd[i] = -1;
+    }
+}
@@ -0,0 +1,45 @@
+/*
+ * perfctr.h - Hardware performance counters for mdriver -P
+ *
+ * Counts user-mode events of the calling thread with the Linux
+ * perf_event_open interface. Each event is opened on its own, so the
+ * kernel can multiplex them when there are more events than hardware
+ * counters; the counts are scaled up by the fraction of time each one
+ * was actually counting. Events the CPU, kernel or container doesn't
+ * allow are left out rather than failing the whole set.
+ */
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+#include <stdint.h>
+
+/* The counted events */
+enum {
+    PC_CYCLES,     /* CPU cycles */
+    PC_INSTRS,     /* retired instructions */
+    PC_L1D_MISS,   /* L1 data cache read misses */
+    PC_LLC_MISS,   /* last level cache misses */
+    PC_BR_MISS,    /* mispredicted branches */
+    PC_DTLB_MISS,  /* data TLB read misses */
+    PERFCTR_NUM
+};
+
+typedef struct {
+    int fd[PERFCTR_NUM];   /* perf event fds, or -1 if not available */
+    uint64_t start[PERFCTR_NUM][3]; /* value, enabled, running at start */
+} perfctr_t;
+
+/* The counts of one measured interval */
+typedef struct {
+    int valid[PERFCTR_NUM];     /* was the event counted at all? */
+    double count[PERFCTR_NUM];  /* event count, scaled for multiplexing */
+} perfctr_vals_t;
+
+extern char *perfctr_names[PERFCTR_NUM];
+
+int perfctr_open(perfctr_t *pc);
+void perfctr_start(perfctr_t *pc);
+void perfctr_stop(perfctr_t *pc, perfctr_vals_t *vals);
+void perfctr_close(perfctr_t *pc);
+
+#endif /* __PERFCTR_H_ */
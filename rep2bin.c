@@ -0,0 +1,122 @@
+/*
+ * rep2bin.c - Convert .rep text traces to the binary trace format
+ *
+ * Usage: rep2bin <file.rep>...
+ *
+ * Each <name>.rep is written next to itself as <name>.bin, which
+ * mdriver reads with mmap instead of parsing (see trace.h).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max string size */
+
+/*
+ * convert - parse the text trace in rep_path and write it to bin_path.
+ *     Returns 0 on success, or -1 after printing what went wrong.
+ */
+static int convert(char *rep_path, char *bin_path)
+{
+    FILE *in, *out;
+    trace_hdr_t hdr;
+    traceop_t op;
+    char type[MAXLINE];
+    unsigned index, size;
+    int num_ops = 0;
+
+    if ((in = fopen(rep_path, "r")) == NULL) {
+	perror(rep_path);
+	return -1;
+    }
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, TRACE_MAGIC_LEN);
+    if (fscanf(in, "%d %d %d %d", &hdr.sugg_heapsize, &hdr.num_ids,
+	       &hdr.num_ops, &hdr.weight) != 4) {
+	fprintf(stderr, "%s: bad trace header\n", rep_path);
+	fclose(in);
+	return -1;
+    }
+    if ((out = fopen(bin_path, "wb")) == NULL) {
+	perror(bin_path);
+	fclose(in);
+	return -1;
+    }
+    fwrite(&hdr, sizeof(hdr), 1, out);
+
+    /* Read every request line and write it out as a traceop_t */
+    while (fscanf(in, "%s", type) != EOF) {
+	memset(&op, 0, sizeof(op));
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(in, "%u %u", &index, &size) != 2)
+		goto bad_op;
+	    op.type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    op.size = size;
+	    break;
+	case 'f':
+	    if (fscanf(in, "%u", &index) != 1)
+		goto bad_op;
+	    op.type = FREE;
+	    break;
+	default:
+	    goto bad_op;
+	}
+	if (index >= (unsigned)hdr.num_ids)
+	    goto bad_op;
+	op.index = index;
+	fwrite(&op, sizeof(op), 1, out);
+	num_ops++;
+    }
+    fclose(in);
+
+    if (num_ops != hdr.num_ops) {
+	fprintf(stderr, "%s: header says %d requests, found %d\n",
+		rep_path, hdr.num_ops, num_ops);
+	fclose(out);
+	remove(bin_path);
+	return -1;
+    }
+    if (fclose(out) != 0) {
+	perror(bin_path);
+	return -1;
+    }
+    return 0;
+
+ bad_op:
+    fprintf(stderr, "%s: bad request %d (%s)\n", rep_path, num_ops + 1, type);
+    fclose(in);
+    fclose(out);
+    remove(bin_path);
+    return -1;
+}
+
+int main(int argc, char **argv)
+{
+    char bin_path[MAXLINE];
+    size_t len;
+    int i, status = 0;
+
+    if (argc < 2) {
+	fprintf(stderr, "Usage: rep2bin <file.rep>...\n");
+	exit(1);
+    }
+    for (i = 1; i < argc; i++) {
+	len = strlen(argv[i]);
+	if (len + 5 > MAXLINE) {
+	    fprintf(stderr, "%s: path too long\n", argv[i]);
+	    status = 1;
+	    continue;
+	}
+	strcpy(bin_path, argv[i]);
+	if (len > 4 && strcmp(bin_path + len - 4, ".rep") == 0)
+	    bin_path[len - 4] = '\0';
+	strcat(bin_path, ".bin");
+	if (convert(argv[i], bin_path) < 0)
+	    status = 1;
+    }
+    exit(status);
+}
@@ -0,0 +1,333 @@
+/*
+ * stream.c - Streaming trace reader and live block table for mdriver -s
+ *
+ * The stream keeps two chunk buffers. The prefetch thread fills a
+ * buffer and marks it full; stream_next hands the full buffers to the
+ * driver in turn, and gives a buffer back to the prefetch thread when
+ * the driver asks for the one after it. A chunk with 0 requests marks
+ * the end of the trace, and one with -1 a decoding error.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <pthread.h>
+
+#include "stream.h"
+
+#define MAXLINE 1024 /* max string size */
+
+struct stream_t {
+    FILE *fp;                   /* trace file, read by the prefetch thread */
+    int binary;                 /* is fp a binary trace? */
+    traceop_t *buf[2];          /* chunk buffers */
+    int count[2];               /* requests in each full buffer */
+    int full[2];                /* has the buffer been decoded? */
+    int next;                   /* buffer stream_next returns next */
+    int held;                   /* buffer the driver is replaying, or -1 */
+    int stop;                   /* set by stream_close */
+    pthread_mutex_t lock;       /* protects count, full and stop */
+    pthread_cond_t cond;        /* signaled whenever full or stop changes */
+    pthread_t prefetcher;
+};
+
+static void *prefetch(void *ptr);
+static int decode_text(stream_t *s, traceop_t *ops);
+static int decode_binary(stream_t *s, traceop_t *ops);
+static void livemap_grow(livemap_t *m);
+
+/*
+ * stream_open - open the trace at path and start prefetching its
+ *     requests. Returns NULL if the file can't be opened or its header
+ *     can't be read.
+ */
+stream_t *stream_open(char *path)
+{
+    stream_t *s;
+    char magic[TRACE_MAGIC_LEN];
+    trace_hdr_t hdr;
+    int sugg_heapsize, num_ids, num_ops, weight;
+
+    if ((s = (stream_t *)calloc(1, sizeof(stream_t))) == NULL)
+	return NULL;
+    if ((s->fp = fopen(path, "r")) == NULL) {
+	free(s);
+	return NULL;
+    }
+
+    /* Skip the header; the stream counts requests as it goes */
+    if (fread(magic, 1, TRACE_MAGIC_LEN, s->fp) == TRACE_MAGIC_LEN &&
+	memcmp(magic, TRACE_MAGIC, TRACE_MAGIC_LEN) == 0) {
+	s->binary = 1;
+	rewind(s->fp);
+	if (fread(&hdr, sizeof(hdr), 1, s->fp) != 1)
+	    goto fail;
+    }
+    else {
+	rewind(s->fp);
+	if (fscanf(s->fp, "%d %d %d %d", &sugg_heapsize, &num_ids,
+		   &num_ops, &weight) != 4)
+	    goto fail;
+    }
+
+    s->buf[0] = (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t));
+    s->buf[1] = (traceop_t *)malloc(STREAM_CHUNK * sizeof(traceop_t));
+    if (s->buf[0] == NULL || s->buf[1] == NULL)
+	goto fail;
+    s->held = -1;
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+    if (pthread_create(&s->prefetcher, NULL, prefetch, s) != 0) {
+	pthread_mutex_destroy(&s->lock);
+	pthread_cond_destroy(&s->cond);
+	goto fail;
+    }
+    return s;
+
+ fail:
+    fclose(s->fp);
+    free(s->buf[0]);
+    free(s->buf[1]);
+    free(s);
+    return NULL;
+}
+
+/*
+ * stream_next - give the previous chunk back and wait for the next one.
+ *     Points *ops at its requests and returns how many there are: 0 at
+ *     the end of the trace, or -1 if the trace is malformed.
+ */
+int stream_next(stream_t *s, traceop_t **ops)
+{
+    int n;
+
+    pthread_mutex_lock(&s->lock);
+    if (s->held >= 0) {
+	s->full[s->held] = 0;
+	s->held = -1;
+	pthread_cond_broadcast(&s->cond);
+    }
+    while (!s->full[s->next])
+	pthread_cond_wait(&s->cond, &s->lock);
+    n = s->count[s->next];
+    if (n > 0) {
+	*ops = s->buf[s->next];
+	s->held = s->next;
+	s->next ^= 1;
+    }
+    pthread_mutex_unlock(&s->lock);
+    return n;
+}
+
+/*
+ * stream_close - stop the prefetch thread and free the stream
+ */
+void stream_close(stream_t *s)
+{
+    pthread_mutex_lock(&s->lock);
+    s->stop = 1;
+    pthread_cond_broadcast(&s->cond);
+    pthread_mutex_unlock(&s->lock);
+    pthread_join(s->prefetcher, NULL);
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+    fclose(s->fp);
+    free(s->buf[0]);
+    free(s->buf[1]);
+    free(s);
+}
+
+/*
+ * prefetch - thread routine that decodes chunks into the two buffers
+ *     in turn, until the end of the trace, an error, or stream_close
+ */
+static void *prefetch(void *ptr)
+{
+    stream_t *s = (stream_t *)ptr;
+    int i = 0, n;
+
+    for (;;) {
+	pthread_mutex_lock(&s->lock);
+	while (s->full[i] && !s->stop)
+	    pthread_cond_wait(&s->cond, &s->lock);
+	if (s->stop) {
+	    pthread_mutex_unlock(&s->lock);
+	    break;
+	}
+	pthread_mutex_unlock(&s->lock);
+
+	/* The driver doesn't touch buffer i until it is marked full */
+	n = s->binary ? decode_binary(s, s->buf[i]) : decode_text(s, s->buf[i]);
+
+	pthread_mutex_lock(&s->lock);
+	s->count[i] = n;
+	s->full[i] = 1;
+	pthread_cond_broadcast(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	if (n <= 0)
+	    break;
+	i ^= 1;
+    }
+    return NULL;
+}
+
+/*
+ * decode_text - parse up to STREAM_CHUNK request lines of a .rep trace
+ */
+static int decode_text(stream_t *s, traceop_t *ops)
+{
+    char type[MAXLINE];
+    unsigned index, size;
+    int n;
+
+    for (n = 0; n < STREAM_CHUNK && fscanf(s->fp, "%s", type) != EOF; n++) {
+	size = 0;
+	switch (type[0]) {
+	case 'a':
+	case 'r':
+	    if (fscanf(s->fp, "%u %u", &index, &size) != 2)
+		return -1;
+	    ops[n].type = (type[0] == 'a') ? ALLOC : REALLOC;
+	    break;
+	case 'f':
+	    if (fscanf(s->fp, "%u", &index) != 1)
+		return -1;
+	    ops[n].type = FREE;
+	    break;
+	default:
+	    return -1;
+	}
+	if (index > INT_MAX || size > INT_MAX)
+	    return -1;
+	ops[n].index = index;
+	ops[n].size = size;
+    }
+    return n;
+}
+
+/*
+ * decode_binary - read up to STREAM_CHUNK requests of a binary trace
+ */
+static int decode_binary(stream_t *s, traceop_t *ops)
+{
+    int i, n;
+
+    n = fread(ops, sizeof(traceop_t), STREAM_CHUNK, s->fp);
+    if (n < STREAM_CHUNK && ferror(s->fp))
+	return -1;
+    for (i = 0; i < n; i++)
+	if ((unsigned)ops[i].type > REALLOC || ops[i].index < 0)
+	    return -1;
+    return n;
+}
+
+/*
+ * The live block table is an open addressing hash table on the id,
+ * kept at most half full. Removal shifts later entries of the same
+ * probe run back, so the table never needs tombstones.
+ */
+#define LIVEMAP_MIN_SLOTS 1024
+#define LIVEMAP_HASH(id) ((size_t)((unsigned)(id) * 2654435761u))
+
+void livemap_init(livemap_t *m)
+{
+    size_t i;
+
+    m->mask = LIVEMAP_MIN_SLOTS - 1;
+    m->count = 0;
+    if ((m->slots = (live_t *)malloc(LIVEMAP_MIN_SLOTS * sizeof(live_t)))
+	== NULL) {
+	fprintf(stderr, "malloc failed in livemap_init\n");
+	exit(1);
+    }
+    for (i = 0; i <= m->mask; i++)
+	m->slots[i].id = -1;
+}
+
+void livemap_free(livemap_t *m)
+{
+    free(m->slots);
+    m->slots = NULL;
+}
+
+/*
+ * livemap_find - the entry of the live block id, or NULL
+ */
+live_t *livemap_find(livemap_t *m, int id)
+{
+    size_t i;
+
+    for (i = LIVEMAP_HASH(id) & m->mask; m->slots[i].id != -1;
+	 i = (i + 1) & m->mask)
+	if (m->slots[i].id == id)
+	    return &m->slots[i];
+    return NULL;
+}
+
+/*
+ * livemap_insert - add an entry for id, which must not be live yet, and
+ *     return it for the caller to fill in
+ */
+live_t *livemap_insert(livemap_t *m, int id)
+{
+    size_t i;
+
+    if (2 * (m->count + 1) > m->mask + 1)
+	livemap_grow(m);
+    for (i = LIVEMAP_HASH(id) & m->mask; m->slots[i].id != -1;
+	 i = (i + 1) & m->mask)
+	;
+    m->slots[i].id = id;
+    m->count++;
+    return &m->slots[i];
+}
+
+/*
+ * livemap_remove - remove the entry e returned by livemap_find
+ */
+void livemap_remove(livemap_t *m, live_t *e)
+{
+    size_t hole = e - m->slots;
+    size_t i, home;
+
+    for (i = (hole + 1) & m->mask; m->slots[i].id != -1;
+	 i = (i + 1) & m->mask) {
+	/* Move entry i into the hole unless its home lies after the hole */
+	home = LIVEMAP_HASH(m->slots[i].id) & m->mask;
+	if (((i - home) & m->mask) >= ((i - hole) & m->mask)) {
+	    m->slots[hole] = m->slots[i];
+	    hole = i;
+	}
+    }
+    m->slots[hole].id = -1;
+    m->count--;
+}
+
+/*
+ * livemap_grow - double the table and reinsert every entry
+ */
+static void livemap_grow(livemap_t *m)
+{
+    live_t *old = m->slots;
+    size_t old_slots = m->mask + 1;
+    size_t i, j;
+
+    m->mask = 2 * old_slots - 1;
+    if ((m->slots = (live_t *)malloc(2 * old_slots * sizeof(live_t)))
+	== NULL) {
+	fprintf(stderr, "malloc failed in livemap_grow\n");
+	exit(1);
+    }
+    for (i = 0; i <= m->mask; i++)
+	m->slots[i].id = -1;
+    for (i = 0; i < old_slots; i++) {
+	if (old[i].id == -1)
+	    continue;
+	for (j = LIVEMAP_HASH(old[i].id) & m->mask; m->slots[j].id != -1;
+	     j = (j + 1) & m->mask)
+	    ;
+	m->slots[j] = old[i];
+    }
+    free(old);
+}
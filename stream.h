@@ -0,0 +1,43 @@
+/*
+ * stream.h - Streaming trace reader and live block table for mdriver -s
+ *
+ * A stream reads a .rep or binary trace (see trace.h) in chunks of
+ * STREAM_CHUNK requests. A prefetch thread decodes the next chunk into
+ * the second of two buffers while the driver replays the first, so the
+ * driver's memory does not grow with the length of the trace.
+ *
+ * A livemap maps the ids of the currently allocated blocks to their
+ * payloads. It replaces the blocks/block_sizes arrays, whose size
+ * depends on the number of ids in the whole trace.
+ */
+#include <stddef.h>
+
+#include "trace.h"
+
+/* Number of requests decoded at once */
+#define STREAM_CHUNK (1 << 16)
+
+typedef struct stream_t stream_t;
+
+stream_t *stream_open(char *path);
+int stream_next(stream_t *s, traceop_t **ops);
+void stream_close(stream_t *s);
+
+/* One allocated block of a streamed trace */
+typedef struct {
+    int id;   /* request id, or -1 for an empty slot */
+    int size; /* payload size asked for */
+    char *p;  /* payload returned by mm_malloc/mm_realloc */
+} live_t;
+
+typedef struct {
+    live_t *slots; /* open addressing table with linear probing */
+    size_t mask;   /* number of slots - 1, a power of 2 minus 1 */
+    size_t count;  /* number of live blocks */
+} livemap_t;
+
+void livemap_init(livemap_t *m);
+void livemap_free(livemap_t *m);
+live_t *livemap_find(livemap_t *m, int id);
+live_t *livemap_insert(livemap_t *m, int id);
+void livemap_remove(livemap_t *m, live_t *e);
@@ -0,0 +1,42 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - Trace requests and the binary trace file format
+ *
+ * A binary trace holds the same information as a .rep text trace
+ * (see traces/README), laid out so that mdriver can mmap the file and
+ * use the request array in place. The file is a trace_hdr_t followed
+ * by num_ops traceop_t records, all in native byte order. rep2bin
+ * converts .rep files to this format.
+ */
+#include <stdint.h>
+
+/* First bytes of every binary trace file */
+#define TRACE_MAGIC "MMTRACE1"
+#define TRACE_MAGIC_LEN 8
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum {ALLOC, FREE, REALLOC} type; /* type of request */
+    int index;                        /* index for free() to use later */
+    int size;                         /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Header of a binary trace, the same four fields as a .rep header */
+typedef struct {
+    char magic[TRACE_MAGIC_LEN]; /* TRACE_MAGIC */
+    int32_t sugg_heapsize;       /* suggested heap size (unused) */
+    int32_t num_ids;             /* number of alloc/realloc ids */
+    int32_t num_ops;             /* number of requests that follow */
+    int32_t weight;              /* weight for this trace (unused) */
+} trace_hdr_t;
+
+/* The requests are stored as is, so their layout must not change */
+typedef char trace_op_layout_check[sizeof(traceop_t) == 3 * sizeof(int32_t)
+				   ? 1 : -1];
+typedef char trace_hdr_layout_check[sizeof(trace_hdr_t) ==
+				    TRACE_MAGIC_LEN + 4 * sizeof(int32_t)
+				    ? 1 : -1];
+
+#endif /* __TRACE_H_ */